@@ -41,6 +41,13 @@ namespace AISNavigation{
     }
   }
 
+  Dijkstra::Dijkstra(Graph* g, const Graph::VertexSet& vertices): _graph(g){
+    for (Graph::VertexSet::const_iterator it=vertices.begin(); it!=vertices.end(); it++){
+      AdjacencyMapEntry entry(*it, 0,0,std::numeric_limits< double >::max());
+      _adjacencyMap.insert(make_pair(entry.child(), entry));
+    }
+  }
+
   void Dijkstra::reset(){
     for (Graph::VertexSet::iterator it=_visited.begin(); it!=_visited.end(); it++){
       AdjacencyMap::iterator at=_adjacencyMap.find(*it);
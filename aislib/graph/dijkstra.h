@@ -55,6 +55,8 @@ namespace AISNavigation{
 
     typedef std::map<Graph::Vertex*, AdjacencyMapEntry> AdjacencyMap;
     Dijkstra(Graph* g);
+    //! restricted to the vertices, the cost function has to reject the edges leading outside of them
+    Dijkstra(Graph* g, const Graph::VertexSet& vertices);
     inline Graph::VertexSet& visited() {return _visited; }
     inline AdjacencyMap& adjacencyMap() {return _adjacencyMap; }
     inline Graph* graph() {return _graph;} 
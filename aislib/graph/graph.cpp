@@ -26,7 +26,11 @@ namespace AISNavigation{
   Graph::Vertex::~Vertex(){
   }
 
+  // edges get increasing ids in the order in which they are created
+  int Graph::Edge::_nextId=0;
+
   Graph::Edge::Edge(Vertex* from_, Vertex* to_){
+    _id=_nextId++;
     _from=from_;
     _to=to_;
   }
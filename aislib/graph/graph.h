@@ -39,10 +39,18 @@ namespace AISNavigation{
         return v1->id()<v2->id();
       }
     };
+
+    struct EdgeIDCompare {
+      bool operator() (const Edge* e1, const Edge* e2) const
+      {
+        return e1->id()<e2->id();
+      }
+    };
     
-    typedef std::set<Edge*> EdgeSet;
+    // the sets are ordered by id and not by address, so that iterating them does not depend on the memory layout
+    typedef std::set<Edge*, EdgeIDCompare> EdgeSet;
     typedef std::map<int, Vertex*> VertexIDMap;
-    typedef std::set<Vertex*> VertexSet;
+    typedef std::set<Vertex*, VertexIDCompare> VertexSet;
  
     struct Vertex{
       friend class Dijkstra;
@@ -65,6 +73,7 @@ namespace AISNavigation{
       friend struct Graph;
       virtual ~Edge();
       virtual bool revert();
+      inline int id() const {return _id;}
       inline const Vertex* from() const {return _from;}
       inline Vertex* from() {return _from;}
       inline const Vertex* to() const {return _to;}
@@ -73,8 +82,10 @@ namespace AISNavigation{
       mutable bool _mark;
     protected:
       Edge(Vertex* from=0, Vertex* to=0);
+      int _id;
       Vertex* _from;
       Vertex* _to;
+      static int _nextId;
     };
 
 
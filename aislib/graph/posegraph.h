@@ -36,19 +36,13 @@ namespace AISNavigation{
       TransformationType localTransformation;
       InformationType covariance;
       virtual ~Vertex();
-      inline InformationType& A() const {return _A;}
-      inline TransformationVectorType& b() const {return _b;}
       inline void backup() { assert(! _isBackup); _backupPose=transformation; _isBackup=true;}
       inline void restore(){ assert(_isBackup); transformation=_backupPose; _isBackup=false; }
-      inline int& tempIndex() const { return _tempIndex; }
       inline bool fixed() const {return _fixed;}
       inline bool& fixed() {return _fixed;}
 
     protected:
       Vertex(int id=-1);
-      mutable InformationType _A;
-      mutable TransformationVectorType _b;
-      mutable int _tempIndex;
       TransformationType _backupPose;
       bool _isBackup;
       bool _fixed;
@@ -65,7 +59,6 @@ namespace AISNavigation{
       virtual bool revert();
       virtual void setAttributes(const TransformationType& m, const InformationType& i);
       double chi2() const;
-      inline InformationType& AFromTo() const {return _AFromTo;}
     protected:
       Edge (Vertex* from, Vertex* to, const TransformationType& mean, const InformationType& information);
       TransformationType _mean;
@@ -79,11 +72,9 @@ namespace AISNavigation{
       InformationType _rcovariance;
       double _rcovDet;
       double _rinfoDet;
-
-      mutable InformationType _AFromTo;
     };
 
-    typedef std::set<Vertex*> VertexSet;
+    typedef std::set<Vertex*, Graph::VertexIDCompare> VertexSet;
 
 
     struct PathLengthCostFunction: public Dijkstra::CostFunction{
@@ -144,6 +135,14 @@ namespace AISNavigation{
     void operator()(typename PG::TransformationVectorType& fij, typename PG::InformationType& dfij_dxi, typename PG::InformationType& dfij_dxj, const typename PG::Edge& e);
   };
 
+  /**
+   * the error of the edge as computed by ManifoldGradient, without the jacobians
+   */
+  template < typename PG > 
+  struct ManifoldError {
+    void operator()(typename PG::TransformationVectorType& fij, const typename PG::Edge& e);
+  };
+
   /**
    * transform the covariance between from and to to a covariance with from located in the origin
    * covariance = J * covariance * J^T
@@ -158,6 +157,14 @@ namespace AISNavigation{
     void operator()(typename PG::TransformationType& t, typename PG::TransformationVectorType::BaseType* update);
   };
 
+  /**
+   * the update which moves from to to as applied by PoseUpdate, i.e. the inverse of PoseUpdate
+   */
+  template < typename PG > 
+  struct PoseDifference {
+    void operator()(typename PG::TransformationVectorType& update, const typename PG::TransformationType& from, const typename PG::TransformationType& to);
+  };
+
 } // end namespace
 
 #include "posegraph.hpp"
@@ -28,7 +28,6 @@ namespace AISNavigation{
 
   template <typename T, typename I>
   PoseGraph<T,I>::Vertex::Vertex(int i) : Graph::Vertex(i){
-    _tempIndex=-1;
     _isBackup=false;
     _fixed=false;
   }
@@ -215,6 +214,13 @@ namespace AISNavigation{
   };
 
 
+  template <typename PG>
+  void ManifoldError<PG>::operator()(typename PG::TransformationVectorType& fij, const typename PG::Edge& e){
+    const typename PG::Vertex* vi = reinterpret_cast<const typename PG::Vertex*>(e.from());
+    const typename PG::Vertex* vj = reinterpret_cast<const typename PG::Vertex*>(e.to());
+    fij = (e.mean(false) * (vi->transformation.inverse() * vj->transformation)).toVector();
+  }
+
   template <typename T, typename I>
   void PoseGraph<T,I>::propagateAlongDijkstraTree(typename PoseGraph<T,I>::Vertex* v, Dijkstra::AdjacencyMap& amap, bool covariance, bool transformation){
     Dijkstra::computeTree(v,amap);
@@ -179,6 +179,16 @@ namespace AISNavigation{
     }
   };
 
+  template <> 
+  struct PoseDifference<PoseGraph2D> {
+    typedef PoseGraph2D PG;
+    void operator()(PG::TransformationVectorType& update, const PG::TransformationType& from, const PG::TransformationType& to)
+    {
+      update = to.toVector() - from.toVector();
+      update[2] = atan2(sin(update[2]), cos(update[2]));
+    }
+  };
+
 }
 
 #endif
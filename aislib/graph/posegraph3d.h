@@ -184,6 +184,25 @@ namespace AISNavigation {
     }
   };
 
+  template <> 
+  struct PoseDifference<PoseGraph3D> {
+    typedef PoseGraph3D PG;
+    void operator()(PG::TransformationVectorType& update, const PG::TransformationType& from, const PG::TransformationType& to)
+    {
+      update[0] = to.translation().x() - from.translation().x();
+      update[1] = to.translation().y() - from.translation().y();
+      update[2] = to.translation().z() - from.translation().z();
+      // axis - axis-length representation of the rotation, the inverse of PoseUpdate::manifoldQuat()
+      Quaternion q = from.rotation().inverse() * to.rotation();
+      q.normalize();
+      double nv = std::sqrt(q.x()*q.x() + q.y()*q.y() + q.z()*q.z());
+      double s = nv > 1e-12 ? 2 * atan2(nv, q.w()) / nv : 2.;
+      update[3] = s * q.x();
+      update[4] = s * q.y();
+      update[5] = s * q.z();
+    }
+  };
+
 
 } // end namespace
 
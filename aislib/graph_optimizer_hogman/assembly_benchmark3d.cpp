@@ -0,0 +1,227 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+//
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+#include "graph/posegraph3d.h"
+#include "csparse_helper.h"
+
+using namespace std;
+using namespace AISNavigation;
+
+/**
+ * compares the assembly of the linear system of a 3D pose graph via the triplet path
+ * (SparseMatrixEntry + sort + cs_compress) with the direct upper triangular assembly.
+ */
+
+static const char* defaultFile = "data/3D/sphere_bignoise.graph";
+
+static double getTime()
+{
+  struct timeval ts;
+  gettimeofday(&ts, 0);
+  return ts.tv_sec + ts.tv_usec*1e-6;
+}
+
+struct LinearizedEdge {
+  int i, j;
+  Matrix6 Aii, Ajj, Aij;
+};
+
+int main(int argc, char** argv)
+{
+  const char* filename = defaultFile;
+  int repeat = 10;
+  for (int c = 1; c < argc; ++c) {
+    if (! strcmp(argv[c], "-r")) {
+      c++;
+      repeat = atoi(argv[c]);
+    } else if (! strcmp(argv[c], "-h")) {
+      cerr << "usage: assembly_benchmark3d [-r <repetitions>] [graph_file]" << endl;
+      return 0;
+    } else {
+      filename = argv[c];
+    }
+  }
+
+  ifstream is(filename);
+  if (! is) {
+    cerr << "Error opening " << filename << endl;
+    return 1;
+  }
+  PoseGraph3D graph;
+  graph.load(is);
+  if (graph.vertices().size() < 2) {
+    cerr << "Graph too small" << endl;
+    return 1;
+  }
+
+  // index mapping, the first vertex is the root and not part of the system
+  int n = 0;
+  map<int, int> index;
+  for (Graph::VertexIDMap::iterator it = graph.vertices().begin(); it != graph.vertices().end(); ++it)
+    index[it->first] = (it == graph.vertices().begin()) ? -1 : n++;
+
+  // linearize once, the benchmark only measures the assembly
+  ManifoldGradient<PoseGraph3D> gradient;
+  vector<LinearizedEdge> linearized;
+  for (Graph::EdgeSet::iterator it = graph.edges().begin(); it != graph.edges().end(); ++it) {
+    PoseGraph3D::Edge* e = reinterpret_cast<PoseGraph3D::Edge*>(*it);
+    Vector6 f;
+    Matrix6 A, B;
+    gradient(f, A, B, *e);
+    const Matrix6& omega = e->information();
+    LinearizedEdge le;
+    le.i = index[e->from()->id()];
+    le.j = index[e->to()->id()];
+    le.Aii = A.transpose()*omega*A;
+    le.Ajj = B.transpose()*omega*B;
+    le.Aij = A.transpose()*omega*B;
+    linearized.push_back(le);
+  }
+  const int dim = 6;
+  const int sparseDim = n * dim;
+
+  // accumulate the diagonal blocks per vertex as the optimizer did before
+  vector<Matrix6> diag(n, Matrix6::eye(0.));
+
+  // *** triplet path ***
+  int nzMax = (n + 2*linearized.size()) * dim * dim;
+  SparseMatrixEntry* entries = new SparseMatrixEntry[nzMax];
+  SparseMatrixEntry** entryPtr = new SparseMatrixEntry*[nzMax];
+  cs* tripletResult = 0;
+  double tripletTime = 0., sortTime = 0.;
+  int tripletNz = 0;
+  for (int r = 0; r < repeat; ++r) {
+    if (tripletResult)
+      cs_spfree(tripletResult);
+    double ts = getTime();
+    for (int i = 0; i < n; ++i)
+      diag[i].fill(0.);
+    for (size_t k = 0; k < linearized.size(); ++k) {
+      const LinearizedEdge& le = linearized[k];
+      if (le.i != -1)
+        diag[le.i] += le.Aii;
+      if (le.j != -1)
+        diag[le.j] += le.Ajj;
+    }
+    SparseMatrixEntry* entry = entries;
+    for (int i = 0; i < n; ++i)
+      for (int q = 0; q < dim; ++q)
+        for (int k = 0; k < dim; ++k)
+          (entry++)->set(i*dim+q, i*dim+k, diag[i][q][k]);
+    for (size_t e = 0; e < linearized.size(); ++e) {
+      const LinearizedEdge& le = linearized[e];
+      if (le.i == -1 || le.j == -1)
+        continue;
+      for (int q = 0; q < dim; ++q)
+        for (int k = 0; k < dim; ++k) {
+          (entry++)->set(le.i*dim+q, le.j*dim+k, le.Aij[q][k]);
+          (entry++)->set(le.j*dim+k, le.i*dim+q, le.Aij[q][k]);
+        }
+    }
+    tripletNz = entry - entries;
+    if (r == 0) { // the sorting was only done in the first iteration
+      double tsSort = getTime();
+      for (int k = 0; k < tripletNz; ++k)
+        entryPtr[k] = entries + k;
+      std::sort(entryPtr, entryPtr + tripletNz, SparseMatrixEntryPtrCmp());
+      sortTime = getTime() - tsSort;
+    }
+    cs* triplet = SparseMatrixEntryPtrVector2CSparse(entryPtr, sparseDim, sparseDim, tripletNz);
+    tripletResult = cs_compress(triplet);
+    cs_spfree(triplet);
+    tripletTime += getTime() - ts;
+  }
+
+  // *** direct upper triangular path ***
+  double patternTime = getTime();
+  vector< vector<int> > blockRows(n);
+  for (size_t k = 0; k < linearized.size(); ++k) {
+    const LinearizedEdge& le = linearized[k];
+    if (le.i == -1 || le.j == -1)
+      continue;
+    blockRows[max(le.i, le.j)].push_back(min(le.i, le.j));
+  }
+  for (int i = 0; i < n; ++i) {
+    blockRows[i].push_back(i);
+    sort(blockRows[i].begin(), blockRows[i].end());
+    blockRows[i].erase(unique(blockRows[i].begin(), blockRows[i].end()), blockRows[i].end());
+  }
+  cs* upper = cs_blockpattern_upper(blockRows, dim);
+  vector<int> diagOffset(n);
+  for (int i = 0; i < n; ++i)
+    diagOffset[i] = (blockRows[i].size() - 1) * dim;
+  vector<int> edgeOffset(linearized.size(), -1);
+  for (size_t k = 0; k < linearized.size(); ++k) {
+    const LinearizedEdge& le = linearized[k];
+    if (le.i != -1 && le.j != -1)
+      edgeOffset[k] = cs_blockoffset(blockRows, min(le.i, le.j), max(le.i, le.j), dim);
+  }
+  patternTime = getTime() - patternTime;
+
+  double directTime = 0.;
+  for (int r = 0; r < repeat; ++r) {
+    double ts = getTime();
+    std::fill(upper->x, upper->x + upper->p[sparseDim], 0.);
+    for (size_t k = 0; k < linearized.size(); ++k) {
+      const LinearizedEdge& le = linearized[k];
+      if (le.i != -1)
+        cs_blockadd_upper(upper, le.i, le.i, diagOffset[le.i], le.Aii, dim);
+      if (le.j != -1)
+        cs_blockadd_upper(upper, le.j, le.j, diagOffset[le.j], le.Ajj, dim);
+      if (le.i != -1 && le.j != -1)
+        cs_blockadd_upper(upper, le.i, le.j, edgeOffset[k], le.Aij, dim);
+    }
+    directTime += getTime() - ts;
+  }
+
+  // both matrices have to yield the same solution
+  vector<double> b1(sparseDim), b2(sparseDim);
+  for (int i = 0; i < sparseDim; ++i)
+    b1[i] = b2[i] = 1. + (i % 7);
+  int ok1 = cs_cholsol(1, tripletResult, &b1[0]);
+  int ok2 = cs_cholsol(1, upper, &b2[0]);
+  double maxDiff = 0.;
+  for (int i = 0; i < sparseDim; ++i)
+    maxDiff = max(maxDiff, fabs(b1[i] - b2[i]));
+
+  cerr << "# graph=               " << filename << endl;
+  cerr << "# vertices=            " << graph.vertices().size() << "  edges= " << graph.edges().size() << endl;
+  cerr << "# repetitions=         " << repeat << endl;
+  cerr << "triplet: nnz= " << tripletResult->p[sparseDim]
+       << "\t time/assembly= " << tripletTime / repeat
+       << "\t one time sort= " << sortTime << endl;
+  cerr << "direct:  nnz= " << upper->p[sparseDim]
+       << "\t time/assembly= " << directTime / repeat
+       << "\t one time pattern= " << patternTime << endl;
+  cerr << "speedup= " << (tripletTime / directTime) << endl;
+  cerr << "solutions " << ((ok1 && ok2) ? "computed" : "FAILED") << ", max difference= " << maxDiff << endl;
+
+  cs_spfree(tripletResult);
+  cs_spfree(upper);
+  delete[] entries;
+  delete[] entryPtr;
+  return (ok1 && ok2) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+//
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+#include "graph_optimizer2d_hchol.h"
+#include "graph_optimizer3d_hchol.h"
+
+using namespace std;
+using namespace AISNavigation;
+
+/**
+ * compares the batch optimization of a graph file by the plain cholesky optimizer with the one
+ * of the hierarchical optimizer. The dimension is taken from the first line of the file.
+ */
+
+static const char* defaultFile = "data/2D/w10000.graph";
+
+static double getTime()
+{
+  struct timeval ts;
+  gettimeofday(&ts, 0);
+  return ts.tv_sec + ts.tv_usec*1e-6;
+}
+
+struct Settings {
+  int iterations;
+  double chi2Tolerance;
+  int numLevels;
+  int nodeDistance;
+  bool guess;
+};
+
+template <typename PG>
+static bool runBatch(const char* name, CholOptimizer<PG>* optimizer, const char* filename, const Settings& s)
+{
+  ifstream is(filename);
+  if (! is) {
+    cerr << "Error opening " << filename << endl;
+    return false;
+  }
+  optimizer->guessOnEdges() = s.guess;
+  HCholOptimizer<PG>* hchol = dynamic_cast<HCholOptimizer<PG>*>(optimizer);
+  for (int l = 0; ; ++l) {
+    CholOptimizer<PG>* opt = hchol ? hchol->level(l) : (l == 0 ? optimizer : 0);
+    if (! opt)
+      break;
+    opt->chi2Tolerance() = s.chi2Tolerance;
+  }
+  optimizer->load(is);
+  optimizer->initialize(0);
+  double initialChi = optimizer->chi2();
+
+  double ts = getTime();
+  optimizer->optimize(s.iterations, false);
+  double dts = getTime() - ts;
+  double finalChi = optimizer->chi2();
+
+  // a second optimization of the unchanged graph, the hierarchy is not rebuilt
+  ts = getTime();
+  optimizer->optimize(s.iterations, false);
+  double dtsAgain = getTime() - ts;
+
+  cerr << name << "\t initial chi= " << initialChi << "\t final chi= " << finalChi
+       << "\t time= " << dts << " s.\t again: chi= " << optimizer->chi2() << " time= " << dtsAgain << " s." << endl;
+  return true;
+}
+
+template <typename PG>
+static bool compare(const char* filename, const Settings& s)
+{
+  CholOptimizer<PG>* chol = new CholOptimizer<PG>();
+  bool ok = runBatch("chol: ", chol, filename, s);
+  delete chol;
+  HCholOptimizer<PG>* hchol = new HCholOptimizer<PG>(s.numLevels, s.nodeDistance);
+  ok = ok && runBatch("hchol:", (CholOptimizer<PG>*) hchol, filename, s);
+  delete hchol;
+  return ok;
+}
+
+int main(int argc, char** argv)
+{
+  const char* filename = defaultFile;
+  Settings s;
+  s.iterations = 20;
+  s.chi2Tolerance = 1e-4;
+  s.numLevels = 3;
+  s.nodeDistance = 2;
+  s.guess = false;
+  for (int c = 1; c < argc; ++c) {
+    if (! strcmp(argv[c], "-i")) {
+      c++;
+      s.iterations = atoi(argv[c]);
+    } else if (! strcmp(argv[c], "-chi2tol")) {
+      c++;
+      s.chi2Tolerance = atof(argv[c]);
+    } else if (! strcmp(argv[c], "-nlevels")) {
+      c++;
+      s.numLevels = atoi(argv[c]);
+    } else if (! strcmp(argv[c], "-nodeDistance")) {
+      c++;
+      s.nodeDistance = atoi(argv[c]);
+    } else if (! strcmp(argv[c], "-guess")) {
+      s.guess = true;
+    } else if (! strcmp(argv[c], "-h")) {
+      cerr << "usage: batch_benchmark [-i <iterations>] [-chi2tol <double>] [-nlevels <int>] [-nodeDistance <int>] [-guess] [graph_file]" << endl;
+      return 0;
+    } else {
+      filename = argv[c];
+    }
+  }
+
+  ifstream is(filename);
+  string tag;
+  if (! (is >> tag)) {
+    cerr << "Error reading " << filename << endl;
+    return 1;
+  }
+  is.close();
+  bool is3D = tag.find('3') != string::npos;
+
+  cerr << "# graph=               " << filename << (is3D ? " (3D)" : " (2D)") << endl;
+  cerr << "# iterations=          " << s.iterations << "  chi2tol= " << s.chi2Tolerance << endl;
+  cerr << "# levels=              " << s.numLevels << "  nodeDistance= " << s.nodeDistance << endl;
+  cerr << "# initial guess (chol)= " << s.guess << endl;
+  bool ok = is3D ? compare<PoseGraph3D>(filename, s) : compare<PoseGraph2D>(filename, s);
+  return ok ? 0 : 1;
+}
@@ -16,7 +16,9 @@
 
 #include "csparse_helper.h"
 
+#include <stuff/thread_pool.h>
 #include <cassert>
+#include <cstring>
 
 namespace AISNavigation {
 
@@ -148,4 +150,1426 @@ csn* cs_chol_workspace (const cs *A, const css *S, int* cin, double* xin)
     return (cs_ndone (N, E, NULL, NULL, 1)) ; /* success: free E,s,x; return N */
 }
 
+/* pattern of the blocks of A, off[p] is the offset of block p within the columns of its block column */
+static cs* cs_blockpattern(const cs* A, int bs, int** off)
+{
+  int nb, nzb, J, p, nz, *Ap, *Ai ;
+  cs* B ;
+  nb = A->n / bs ; Ap = A->p ; Ai = A->i ;
+  nzb = 0 ;
+  for (J = 0 ; J < nb ; J++)
+    for (p = Ap [J*bs] ; p < Ap [J*bs+1] ; p++)
+      if (Ai [p] % bs == 0) nzb++ ;
+  B = cs_spalloc (nb, nb, nzb, 0, 0) ;
+  if (!B) return (NULL) ;
+  if (off) {
+    *off = (int*) cs_malloc (nzb, sizeof (int)) ;
+    if (!*off) return (cs_spfree (B)) ;
+  }
+  nz = 0 ;
+  for (J = 0 ; J < nb ; J++) {
+    B->p [J] = nz ;
+    for (p = Ap [J*bs] ; p < Ap [J*bs+1] ; p++) {
+      if (Ai [p] % bs != 0) continue ;
+      B->i [nz] = Ai [p] / bs ;
+      if (off) (*off) [nz] = p - Ap [J*bs] ;
+      nz++ ;
+    }
+  }
+  B->p [nb] = nz ;
+  return (B) ;
+}
+
+/* --- nested dissection of the block graph --- */
+
+#define CS_ND_LEAF 64
+
+/* breadth first search among the nodes tagged with id, returns the number of reached nodes */
+static int nd_bfs(const int* Gp, const int* Gi, int start, const int* tag, int id, int* level, int* queue)
+{
+  int head = 0, tail = 0, v, w, p ;
+  queue [tail++] = start ;
+  level [start] = 0 ;
+  while (head < tail) {
+    v = queue [head++] ;
+    for (p = Gp [v] ; p < Gp [v+1] ; p++) {
+      w = Gi [p] ;
+      if (tag [w] != id || level [w] >= 0) continue ;
+      level [w] = level [v] + 1 ;
+      queue [tail++] = w ;
+    }
+  }
+  return (tail) ;
+}
+
+/* orders the nodes of a small part by AMD on the induced subgraph */
+static void nd_leaf(const int* Gp, const int* Gi, int* nodes, int nn, int* tag, int id, int* local, int* tmp)
+{
+  int i, p, nz, *P ;
+  cs* C ;
+  for (i = 0 ; i < nn ; i++) {
+    tag [nodes [i]] = id ;
+    local [nodes [i]] = i ;
+  }
+  nz = nn ;
+  for (i = 0 ; i < nn ; i++)
+    for (p = Gp [nodes [i]] ; p < Gp [nodes [i]+1] ; p++)
+      if (tag [Gi [p]] == id) nz++ ;
+  C = cs_spalloc (nn, nn, nz, 0, 0) ;
+  if (!C) return ;  // keep the order
+  nz = 0 ;
+  for (i = 0 ; i < nn ; i++) {
+    C->p [i] = nz ;
+    C->i [nz++] = i ;
+    for (p = Gp [nodes [i]] ; p < Gp [nodes [i]+1] ; p++)
+      if (tag [Gi [p]] == id) C->i [nz++] = local [Gi [p]] ;
+  }
+  C->p [nn] = nz ;
+  P = cs_amd (1, C) ;
+  cs_spfree (C) ;
+  if (!P) return ;
+  for (i = 0 ; i < nn ; i++) tmp [i] = nodes [P [i]] ;
+  for (i = 0 ; i < nn ; i++) nodes [i] = tmp [i] ;
+  cs_free (P) ;
+}
+
+/*
+ * orders nodes [0 ... nn-1] in place: the graph is split by a level set of a breadth first search
+ * from a pseudo peripheral node, both halves are ordered recursively and the separator comes last.
+ */
+static void nd_order(const int* Gp, const int* Gi, int* nodes, int nn, int* tag, int* nextId, int* level, int* queue, int* tmp)
+{
+  int i, p, v, id, reached, start, L, n1, n2, ns, maxLevel, cnt ;
+  id = (*nextId)++ ;
+  if (nn <= CS_ND_LEAF) {
+    nd_leaf (Gp, Gi, nodes, nn, tag, id, level, tmp) ;
+    return ;
+  }
+  for (i = 0 ; i < nn ; i++) {
+    tag [nodes [i]] = id ;
+    level [nodes [i]] = -1 ;
+  }
+  // pseudo peripheral node: the last one reached by a search from an arbitrary node
+  reached = nd_bfs (Gp, Gi, nodes [0], tag, id, level, queue) ;
+  start = queue [reached-1] ;
+  for (i = 0 ; i < reached ; i++) level [queue [i]] = -1 ;
+  reached = nd_bfs (Gp, Gi, start, tag, id, level, queue) ;
+
+  n1 = n2 = ns = 0 ;
+  if (reached < nn) {
+    // not connected, the reached component and the rest are independent
+    for (i = 0 ; i < nn ; i++) {
+      v = nodes [i] ;
+      if (level [v] >= 0) queue [n1++] = v ; else tmp [n2++] = v ;
+    }
+  } else {
+    // the level which splits the nodes in halves, its nodes adjacent to the next level separate
+    maxLevel = level [queue [reached-1]] ;
+    L = 0 ; cnt = 0 ;
+    for (i = 0 ; i < reached ; i++) {
+      if (2 * (cnt + 1) > nn) { L = level [queue [i]] ; break ; }
+      cnt++ ;
+    }
+    if (L >= maxLevel) L = maxLevel - 1 ;
+    if (L < 0) {
+      nd_leaf (Gp, Gi, nodes, nn, tag, id, level, tmp) ;
+      return ;
+    }
+    // queue: part one, tmp: part two followed by the separator (in reverse)
+    for (i = 0 ; i < nn ; i++) {
+      v = nodes [i] ;
+      if (level [v] > L) {
+        tmp [n2++] = v ;
+      } else if (level [v] < L) {
+        queue [n1++] = v ;
+      } else {
+        int sep = 0 ;
+        for (p = Gp [v] ; p < Gp [v+1] && !sep ; p++)
+          sep = (tag [Gi [p]] == id && level [Gi [p]] == L+1) ;
+        if (sep) tmp [nn - 1 - ns++] = v ; else queue [n1++] = v ;
+      }
+    }
+  }
+  if (n1 == 0 || n2 == 0) {
+    nd_leaf (Gp, Gi, nodes, nn, tag, id, level, tmp) ;
+    return ;
+  }
+  for (i = 0 ; i < n1 ; i++) nodes [i] = queue [i] ;
+  for (i = 0 ; i < n2 ; i++) nodes [n1+i] = tmp [i] ;
+  for (i = 0 ; i < ns ; i++) nodes [n1+n2+i] = tmp [nn-1-i] ;
+  nd_order (Gp, Gi, nodes, n1, tag, nextId, level, queue, tmp) ;
+  nd_order (Gp, Gi, nodes + n1, n2, tag, nextId, level, queue, tmp) ;
+}
+
+/* nested dissection ordering of the pattern B, the upper triangle of a symmetric matrix */
+static int* cs_nd(const cs* B)
+{
+  int n, j, p, i, nextId, *Gp, *Gi, *w, *P, *tag, *level, *queue, *tmp ;
+  n = B->n ;
+  Gp = (int*) cs_calloc (n+1, sizeof (int)) ;
+  w = (int*) cs_calloc (n, sizeof (int)) ;
+  Gi = (int*) cs_malloc (2 * B->p [n], sizeof (int)) ;
+  P = (int*) cs_malloc (n, sizeof (int)) ;
+  tag = (int*) cs_malloc (n, sizeof (int)) ;
+  level = (int*) cs_malloc (n, sizeof (int)) ;
+  queue = (int*) cs_malloc (n, sizeof (int)) ;
+  tmp = (int*) cs_malloc (n, sizeof (int)) ;
+  if (!Gp || !w || !Gi || !P || !tag || !level || !queue || !tmp) {
+    cs_free (Gp) ; cs_free (w) ; cs_free (Gi) ; cs_free (tag) ; cs_free (level) ; cs_free (queue) ; cs_free (tmp) ;
+    return ((int*) cs_free (P)) ;
+  }
+  // adjacency of both triangles without the diagonal
+  for (j = 0 ; j < n ; j++)
+    for (p = B->p [j] ; p < B->p [j+1] ; p++)
+      if ((i = B->i [p]) != j) { w [i]++ ; w [j]++ ; }
+  cs_cumsum (Gp, w, n) ;
+  for (j = 0 ; j < n ; j++)
+    for (p = B->p [j] ; p < B->p [j+1] ; p++)
+      if ((i = B->i [p]) != j) { Gi [w [i]++] = j ; Gi [w [j]++] = i ; }
+  for (j = 0 ; j < n ; j++) {
+    P [j] = j ;
+    tag [j] = -1 ;
+  }
+  nextId = 0 ;
+  nd_order (Gp, Gi, P, n, tag, &nextId, level, queue, tmp) ;
+  cs_free (Gp) ; cs_free (w) ; cs_free (Gi) ; cs_free (tag) ; cs_free (level) ; cs_free (queue) ; cs_free (tmp) ;
+  return (P) ;
+}
+
+int* cs_blockorder(int order, const cs* A, int bs)
+{
+  cs* B ;
+  int* P ;
+  if (!CS_CSC (A) || bs <= 0 || A->n % bs) return (NULL) ;
+  B = cs_blockpattern (A, bs, NULL) ;
+  if (!B) return (NULL) ;
+  switch (order) {
+    case CS_ORDER_AMD: P = cs_amd (1, B) ; break ;
+    case CS_ORDER_NESTED_DISSECTION: P = cs_nd (B) ; break ;
+    default: P = cs_amd (0, B) ; break ;
+  }
+  cs_spfree (B) ;
+  return (P) ;
+}
+
+css* cs_blockschol_perm(const int* P, const cs* A, int bs)
+{
+  int n, *c, *post ;
+  cs *B, *C ;
+  css* S ;
+  if (!CS_CSC (A) || bs <= 0 || A->n % bs) return (NULL) ;
+  B = cs_blockpattern (A, bs, NULL) ;
+  if (!B) return (NULL) ;
+  // see cs_schol()
+  n = B->n ;
+  S = (css*) cs_calloc (1, sizeof (css)) ;
+  if (!S) return ((css*) cs_spfree (B)) ;
+  S->pinv = cs_pinv (P, n) ;
+  if (P && !S->pinv) {
+    cs_spfree (B) ;
+    return (cs_sfree (S)) ;
+  }
+  C = cs_symperm (B, S->pinv, 0) ;
+  cs_spfree (B) ;
+  S->parent = cs_etree (C, 0) ;
+  post = cs_post (S->parent, n) ;
+  c = cs_counts (C, S->parent, post, 0) ;
+  cs_free (post) ;
+  cs_spfree (C) ;
+  S->cp = (int*) cs_malloc (n+1, sizeof (int)) ;
+  S->unz = S->lnz = cs_cumsum (S->cp, c, n) ;
+  cs_free (c) ;
+  return ((S->lnz >= 0) ? S : cs_sfree (S)) ;
+}
+
+css* cs_blockschol(int order, const cs* A, int bs)
+{
+  int* P = cs_blockorder (order, A, bs) ;
+  if (!P && order != CS_ORDER_NATURAL) return (NULL) ;
+  css* S = cs_blockschol_perm (P, A, bs) ;
+  cs_free (P) ;
+  return (S) ;
+}
+
+void cs_blockcholstats(const css* S, int nb, int bs, double* nnzL, double* flops)
+{
+  double nz = 0., fl = 0. ;
+  for (int k = 0 ; k < nb ; k++) {
+    double cnt = (S->cp [k+1] - S->cp [k]) * bs ;  // rows of each of the bs columns
+    nz += cnt * bs ;
+    fl += cnt * cnt * bs ;
+  }
+  if (nnzL) *nnzL = nz ;
+  if (flops) *flops = fl ;
+}
+
+/*
+ * tasks of the parallel factorization. The etree is cut into subtrees whose estimated work
+ * is small enough to be processed by one thread in increasing column order, the remaining
+ * nodes close to the roots form a task each. The rows of L belonging to disjoint subtrees
+ * touch disjoint parts of c, X and L, hence a task may run as soon as its child tasks are done.
+ */
+struct cs_block_schedule
+{
+  int nthreads ;  // threads the stacks have been allocated for
+  int ntasks ;
+  int* Tp ;       // nodes of task t are Tnode [Tp [t]] ... Tnode [Tp [t+1]-1] in increasing order
+  int* Tnode ;
+  int* Tparent ;  // parent task, -1 for the roots of the etree
+  int* Tcp ;      // child tasks of t are Tci [Tcp [t]] ... Tci [Tcp [t+1]-1]
+  int* Tci ;
+  int* Rp ;       // off-diagonal blocks of row k of L are in the columns Ri [Rp [k]] ... Ri [Rp [k+1]-1]
+  int* Ri ;
+  int* Rx ;       // position of these blocks in L
+  int* pending ;  // number of unfinished child tasks
+  int* stack ;    // nb ints per thread for cs_ereach
+  volatile int ok ;
+};
+
+static cs_block_schedule* cs_blocksfree(cs_block_schedule* T)
+{
+  if (!T) return (NULL) ;
+  cs_free (T->Tp) ;
+  cs_free (T->Tnode) ;
+  cs_free (T->Tparent) ;
+  cs_free (T->Tcp) ;
+  cs_free (T->Tci) ;
+  cs_free (T->Rp) ;
+  cs_free (T->Ri) ;
+  cs_free (T->Rx) ;
+  cs_free (T->pending) ;
+  cs_free (T->stack) ;
+  return ((cs_block_schedule*) cs_free (T)) ;
+}
+
+csbn* cs_blocknfree(csbn* N)
+{
+  if (!N) return (NULL) ;
+  cs_blocksfree (N->sched) ;
+  cs_free (N->p) ;
+  cs_free (N->i) ;
+  cs_free (N->x) ;
+  cs_free (N->xf) ;
+  cs_spfree (N->C) ;
+  cs_free (N->Cj) ;
+  cs_free (N->Coff) ;
+  cs_free (N->Cmode) ;
+  return ((csbn*) cs_free (N)) ;
+}
+
+csbn* cs_blockchol_alloc(const cs* A, const css* S, int bs, csbn* N, int single)
+{
+  int nb, p, q, J, k, i2, j2, *pinv, *cp, *off, *Bp, *Bi, *Cp, *Ci, *w ;
+  cs* B ;
+  if (!CS_CSC (A) || !S || !S->cp || !S->parent || bs <= 0 || A->n % bs) return (cs_blocknfree (N)) ;
+  nb = A->n / bs ;
+  pinv = S->pinv ; cp = S->cp ;
+  B = cs_blockpattern (A, bs, &off) ;
+  if (!B) return (cs_blocknfree (N)) ;
+  Bp = B->p ; Bi = B->i ;
+  // re-use the storage of N if it is large enough and of the requested precision
+  if (N && (N->bs != bs || N->nbmax < nb || N->lnzmax < cp [nb] || N->C->nzmax < Bp [nb] || (N->xf != NULL) != (single != 0))) {
+    N = cs_blocknfree (N) ;
+  }
+  w = (int*) cs_calloc (nb, sizeof (int)) ;
+  if (!N && w) {
+    N = (csbn*) cs_calloc (1, sizeof (csbn)) ;
+    if (N) {
+      N->bs = bs ;
+      N->nbmax = 2 * nb ;
+      N->lnzmax = 2 * cp [nb] ;
+      N->p = (int*) cs_malloc (N->nbmax+1, sizeof (int)) ;
+      N->i = (int*) cs_malloc (N->lnzmax, sizeof (int)) ;
+      if (single)
+        N->xf = (float*) cs_malloc (N->lnzmax * bs * bs, sizeof (float)) ;
+      else
+        N->x = (double*) cs_malloc (N->lnzmax * bs * bs, sizeof (double)) ;
+      N->C = cs_spalloc (N->nbmax, N->nbmax, 2 * Bp [nb], 0, 0) ;
+      if (N->C) {
+        N->Cj = (int*) cs_malloc (N->C->nzmax, sizeof (int)) ;
+        N->Coff = (int*) cs_malloc (N->C->nzmax, sizeof (int)) ;
+        N->Cmode = (int*) cs_malloc (N->C->nzmax, sizeof (int)) ;
+      }
+    }
+  }
+  if (!w || !N || !N->p || !N->i || (!N->x && !N->xf) || !N->C || !N->Cj || !N->Coff || !N->Cmode) {
+    cs_free (off) ; cs_spfree (B) ; cs_free (w) ;
+    return (cs_blocknfree (N)) ;
+  }
+  N->nb = nb ;
+  N->C->m = N->C->n = nb ;
+  N->sched = cs_blocksfree (N->sched) ; // the schedule depends on the symbolic analysis
+  for (k = 0 ; k <= nb ; k++) N->p [k] = cp [k] ;
+
+  // the block pattern of C=P*A*P', each block knows its source in A
+  Cp = N->C->p ; Ci = N->C->i ;
+  for (J = 0 ; J < nb ; J++) {
+    j2 = pinv ? pinv [J] : J ;
+    for (p = Bp [J] ; p < Bp [J+1] ; p++) {
+      i2 = pinv ? pinv [Bi [p]] : Bi [p] ;
+      w [CS_MAX (i2, j2)]++ ;
+    }
+  }
+  cs_cumsum (Cp, w, nb) ;
+  for (J = 0 ; J < nb ; J++) {
+    j2 = pinv ? pinv [J] : J ;
+    for (p = Bp [J] ; p < Bp [J+1] ; p++) {
+      i2 = pinv ? pinv [Bi [p]] : Bi [p] ;
+      q = w [CS_MAX (i2, j2)]++ ;
+      Ci [q] = CS_MIN (i2, j2) ;
+      N->Cj [q] = J ;
+      N->Coff [q] = off [p] ;
+      N->Cmode [q] = (Bi [p] == J) ? CS_BLOCK_DIAGONAL : ((i2 < j2) ? CS_BLOCK_UPPER : CS_BLOCK_TRANSPOSED) ;
+    }
+  }
+  cs_free (off) ; cs_spfree (B) ; cs_free (w) ;
+  return (N) ;
+}
+
+/* builds the task schedule of N for nthreads threads, see cs_block_schedule */
+static cs_block_schedule* cs_blockschedule(const css* S, const csbn* N, int nthreads)
+{
+  int nb, k, p, q, t, top, ntasks, *parent, *cp, *owner, *c, *Li ;
+  double total, limit, *work ;
+  cs_block_schedule* T ;
+  nb = N->nb ; parent = S->parent ; cp = S->cp ;
+  T = (cs_block_schedule*) cs_calloc (1, sizeof (cs_block_schedule)) ;
+  work = (double*) cs_malloc (nb, sizeof (double)) ;
+  owner = (int*) cs_malloc (nb, sizeof (int)) ;
+  c = (int*) cs_malloc (nb+1, sizeof (int)) ;
+  Li = (int*) cs_malloc (cp [nb], sizeof (int)) ;
+  if (T) {
+    T->nthreads = nthreads ;
+    T->Tp = (int*) cs_malloc (nb+1, sizeof (int)) ;
+    T->Tnode = (int*) cs_malloc (nb, sizeof (int)) ;
+    T->Tparent = (int*) cs_malloc (nb, sizeof (int)) ;
+    T->Tcp = (int*) cs_malloc (nb+1, sizeof (int)) ;
+    T->Tci = (int*) cs_malloc (nb, sizeof (int)) ;
+    T->Rp = (int*) cs_malloc (nb+1, sizeof (int)) ;
+    T->Ri = (int*) cs_malloc (cp [nb], sizeof (int)) ;
+    T->Rx = (int*) cs_malloc (cp [nb], sizeof (int)) ;
+    T->pending = (int*) cs_malloc (nb, sizeof (int)) ;
+    T->stack = (int*) cs_malloc (nb * nthreads, sizeof (int)) ;
+  }
+  if (!T || !work || !owner || !c || !Li || !T->Tp || !T->Tnode || !T->Tparent || !T->Tcp || !T->Tci
+      || !T->Rp || !T->Ri || !T->Rx || !T->pending || !T->stack) {
+    cs_free (work) ; cs_free (owner) ; cs_free (c) ; cs_free (Li) ;
+    return (cs_blocksfree (T)) ;
+  }
+
+  // estimated work of each subtree, a column with c blocks costs about c^2 block operations
+  total = 0. ;
+  for (k = 0 ; k < nb ; k++) work [k] = 0. ;
+  for (k = 0 ; k < nb ; k++) {
+    double cnt = cp [k+1] - cp [k] ;
+    work [k] += cnt * cnt ;
+    total += cnt * cnt ;
+    if (parent [k] != -1) work [parent [k]] += work [k] ;   // parent [k] > k
+  }
+  limit = total / (4. * nthreads) ;
+  // root of the task of each node, the parents are visited before their children
+  for (k = nb-1 ; k >= 0 ; k--) {
+    int pk = parent [k] ;
+    owner [k] = (work [k] > limit || pk == -1 || work [pk] > limit) ? k : owner [pk] ;
+  }
+  ntasks = 0 ;
+  for (k = 0 ; k < nb ; k++)
+    if (owner [k] == k) c [k] = ntasks++ ;
+  for (k = 0 ; k < nb ; k++)
+    owner [k] = c [owner [k]] ;
+  T->ntasks = ntasks ;
+
+  // nodes of each task in increasing order and the task tree
+  for (t = 0 ; t < ntasks ; t++) c [t] = T->Tcp [t] = 0 ;
+  for (k = 0 ; k < nb ; k++) c [owner [k]]++ ;
+  cs_cumsum (T->Tp, c, ntasks) ;
+  for (k = 0 ; k < nb ; k++) {
+    t = owner [k] ;
+    T->Tnode [c [t]++] = k ;
+    if (c [t] == T->Tp [t+1]) { // k is the largest node, i.e. the root of the task
+      T->Tparent [t] = (parent [k] == -1) ? -1 : owner [parent [k]] ;
+      if (parent [k] != -1) T->Tcp [T->Tparent [t]]++ ;
+    }
+  }
+  for (t = 0 ; t < ntasks ; t++) c [t] = T->Tcp [t] ;
+  cs_cumsum (T->Tcp, c, ntasks) ;
+  for (t = 0 ; t < ntasks ; t++)
+    if (T->Tparent [t] != -1) T->Tci [c [T->Tparent [t]]++] = t ;
+
+  // pattern of L as computed by the numeric factorization, stored by rows
+  for (k = 0 ; k < nb ; k++) c [k] = cp [k] ;
+  for (k = 0 ; k < nb ; k++) {
+    for (top = cs_ereach (N->C, k, parent, T->stack, c) ; top < nb ; top++)
+      Li [c [T->stack [top]]++] = k ;
+    Li [c [k]++] = k ;
+  }
+  for (k = 0 ; k < nb ; k++) c [k] = 0 ;
+  for (k = 0 ; k < nb ; k++)
+    for (p = cp [k] + 1 ; p < cp [k+1] ; p++) c [Li [p]]++ ;
+  cs_cumsum (T->Rp, c, nb) ;
+  for (k = 0 ; k < nb ; k++)
+    for (p = cp [k] + 1 ; p < cp [k+1] ; p++) {
+      q = c [Li [p]]++ ;
+      T->Ri [q] = k ;
+      T->Rx [q] = p ;
+    }
+  cs_free (work) ; cs_free (owner) ; cs_free (c) ; cs_free (Li) ;
+  return (T) ;
+}
+
+/* values of the factor in the precision T */
+template <typename T> static inline T* blockvalues(const csbn* N);
+template <> inline double* blockvalues<double>(const csbn* N) { return N->x; }
+template <> inline float* blockvalues<float>(const csbn* N) { return N->xf; }
+
+/* dense kernels on BS x BS blocks stored in column major order */
+
+/* in place cholesky of the lower triangle of D, returns 0 if D is not positive definite */
+template <int BS, typename T>
+static inline int blockCholesky(T* D)
+{
+  for (int j = 0; j < BS; j++) {
+    T d = D[j*BS+j];
+    for (int k = 0; k < j; k++)
+      d -= D[k*BS+j] * D[k*BS+j];
+    if (d <= 0)
+      return 0;
+    d = sqrt(d);
+    D[j*BS+j] = d;
+    for (int i = j+1; i < BS; i++) {
+      T v = D[j*BS+i];
+      for (int k = 0; k < j; k++)
+        v -= D[k*BS+i] * D[k*BS+j];
+      D[j*BS+i] = v / d;
+      D[i*BS+j] = 0.;
+    }
+  }
+  return 1;
+}
+
+/* x = L\x for the lower triangular block L */
+template <int BS, typename T, typename TX>
+static inline void blockLowerSolve(const T* L, TX* x)
+{
+  for (int r = 0; r < BS; r++) {
+    TX v = x[r];
+    for (int k = 0; k < r; k++)
+      v -= L[k*BS+r] * x[k];
+    x[r] = v / L[r*BS+r];
+  }
+}
+
+/* x = L'\x for the lower triangular block L */
+template <int BS, typename T, typename TX>
+static inline void blockLowerTransposedSolve(const T* L, TX* x)
+{
+  for (int r = BS-1; r >= 0; r--) {
+    TX v = x[r];
+    for (int k = r+1; k < BS; k++)
+      v -= L[r*BS+k] * x[k];
+    x[r] = v / L[r*BS+r];
+  }
+}
+
+/*
+ * row k of L, see cs_chol(). c holds the column pointers, s is a stack of nb ints, X the dense block workspace.
+ * The factor is computed in the precision T of its values.
+ */
+template <int BS, typename T>
+static inline int blockcholrow(const cs* A, csbn* N, const css* S, int k, int* c, int* s, T* X)
+{
+  const int bb = BS*BS;
+  int nb, p, q, i, r, J, top, mode, *parent, *Cp, *Ci, *Ap, *Lp, *Li;
+  double *Ax;
+  T *Lx, D[bb], Y[bb];
+  nb = N->nb ;
+  parent = S->parent ;
+  Ap = A->p ; Ax = A->x ;
+  Cp = N->C->p ; Ci = N->C->i ;
+  Lp = N->p ; Li = N->i ; Lx = blockvalues<T> (N) ;
+
+  /* --- nonzero pattern of L(k,:) and scatter of C(:,k) --- */
+  top = cs_ereach (N->C, k, parent, s, c) ;
+  /* the blocks of the pattern are cleared first, X may have been used as workspace by another routine */
+  for (p = top ; p < nb ; p++) {
+    T* Xi = X + s [p]*bb ;
+    for (q = 0 ; q < bb ; q++) Xi [q] = 0. ;
+  }
+  T* Xk = X + k*bb ;
+  for (q = 0 ; q < bb ; q++) Xk [q] = 0. ;
+  for (p = Cp [k] ; p < Cp [k+1] ; p++) {
+    T* Xi = X + Ci [p]*bb ;
+    J = N->Cj [p] ;
+    mode = N->Cmode [p] ;
+    const double* Ablock = Ax + N->Coff [p] ;
+    for (int kk = 0 ; kk < BS ; kk++) {
+      const double* column = Ablock + Ap [J*BS+kk] ;
+      if (mode == CS_BLOCK_DIAGONAL) {
+        for (q = 0 ; q <= kk ; q++)
+          Xi [kk*BS+q] = Xi [q*BS+kk] = column [q] ;
+      } else if (mode == CS_BLOCK_UPPER) {
+        for (q = 0 ; q < BS ; q++)
+          Xi [kk*BS+q] = column [q] ;
+      } else {
+        for (q = 0 ; q < BS ; q++)
+          Xi [q*BS+kk] = column [q] ;
+      }
+    }
+  }
+  for (q = 0 ; q < bb ; q++) {
+    D [q] = Xk [q] ;
+    Xk [q] = 0. ;
+  }
+  /* --- block triangular solve --- */
+  for ( ; top < nb ; top++) {
+    i = s [top] ;
+    T* Xi = X + i*bb ;
+    const T* Lii = Lx + Lp [i]*bb ;
+    /* Y = L(i,i)\X(i), L(k,i)=Y' */
+    for (q = 0 ; q < bb ; q++) {
+      Y [q] = Xi [q] ;
+      Xi [q] = 0. ;
+    }
+    for (int cc = 0 ; cc < BS ; cc++)
+      blockLowerSolve<BS> (Lii, Y + cc*BS) ;
+    /* X(r) -= L(r,i)*L(k,i)' */
+    for (p = Lp [i] + 1 ; p < c [i] ; p++) {
+      T* Xr = X + Li [p]*bb ;
+      const T* Lri = Lx + p*bb ;
+      for (int cc = 0 ; cc < BS ; cc++)
+        for (int kk = 0 ; kk < BS ; kk++) {
+          const T y = Y [cc*BS+kk] ;
+          for (r = 0 ; r < BS ; r++)
+            Xr [cc*BS+r] -= Lri [kk*BS+r] * y ;
+        }
+    }
+    /* D -= L(k,i)*L(k,i)' */
+    for (int cc = 0 ; cc < BS ; cc++)
+      for (r = cc ; r < BS ; r++) {
+        T v = 0. ;
+        for (int kk = 0 ; kk < BS ; kk++)
+          v += Y [r*BS+kk] * Y [cc*BS+kk] ;
+        D [cc*BS+r] -= v ;
+      }
+    p = c [i]++ ;
+    Li [p] = k ;
+    T* Lki = Lx + p*bb ;
+    for (int cc = 0 ; cc < BS ; cc++)
+      for (r = 0 ; r < BS ; r++)
+        Lki [cc*BS+r] = Y [r*BS+cc] ;
+  }
+  /* --- L(k,k) --- */
+  if (!blockCholesky<BS> (D))
+    return (0) ;
+  p = c [k]++ ;
+  Li [p] = k ;
+  T* Lkk = Lx + p*bb ;
+  for (q = 0 ; q < bb ; q++)
+    Lkk [q] = D [q] ;
+  return (1) ;
+}
+
+template <int BS, typename T>
+static int blockchol(const cs* A, csbn* N, const css* S, int* work, T* xwork)
+{
+  int nb, k, *c, *s, *cp ;
+  nb = N->nb ;
+  cp = S->cp ;
+  c = work ; s = work + nb ;
+  for (k = 0 ; k < nb ; k++) c [k] = cp [k] ;
+  for (k = 0 ; k < nb ; k++)
+    if (!blockcholrow<BS> (A, N, S, k, c, s, xwork))
+      return (0) ;
+  return (1) ;
+}
+
+template <int BS, typename T>
+static void blocklsolve(const csbn* N, double* x)
+{
+  const int bb = BS*BS;
+  const int *Lp = N->p, *Li = N->i;
+  const T* Lx = blockvalues<T>(N);
+  for (int j = 0; j < N->nb; j++) {
+    double* xj = x + j*BS;
+    blockLowerSolve<BS>(Lx + Lp[j]*bb, xj);
+    for (int p = Lp[j]+1; p < Lp[j+1]; p++) {
+      double* xr = x + Li[p]*BS;
+      const T* L = Lx + p*bb;
+      for (int k = 0; k < BS; k++)
+        for (int r = 0; r < BS; r++)
+          xr[r] -= L[k*BS+r] * xj[k];
+    }
+  }
+}
+
+/* x(j) = L(j,j)'\(x(j) - L(:,j)'*x), reads x of the ancestors of j only */
+template <int BS, typename T>
+static inline void blockltsolvecolumn(const csbn* N, int j, double* x)
+{
+  const int bb = BS*BS;
+  const int *Lp = N->p, *Li = N->i;
+  const T* Lx = blockvalues<T>(N);
+  double* xj = x + j*BS;
+  for (int p = Lp[j]+1; p < Lp[j+1]; p++) {
+    const double* xr = x + Li[p]*BS;
+    const T* L = Lx + p*bb;
+    for (int k = 0; k < BS; k++)
+      for (int r = 0; r < BS; r++)
+        xj[k] -= L[k*BS+r] * xr[r];
+  }
+  blockLowerTransposedSolve<BS>(Lx + Lp[j]*bb, xj);
+}
+
+template <int BS, typename T>
+static void blockltsolve(const csbn* N, double* x)
+{
+  for (int j = N->nb-1; j >= 0; j--)
+    blockltsolvecolumn<BS, T>(N, j, x);
+}
+
+/*
+ * x(k) = L(k,k)\(x(k) - L(k,:)*x), reads x of the descendants of k only.
+ * The blocks are subtracted in the same order as by blocklsolve().
+ */
+template <int BS, typename T>
+static inline void blocklsolverow(const csbn* N, const cs_block_schedule* S, int k, double* x)
+{
+  const int bb = BS*BS;
+  const T* Lx = blockvalues<T>(N);
+  double* xk = x + k*BS;
+  for (int q = S->Rp[k]; q < S->Rp[k+1]; q++) {
+    const double* xi = x + S->Ri[q]*BS;
+    const T* L = Lx + S->Rx[q]*bb;
+    for (int cc = 0; cc < BS; cc++)
+      for (int r = 0; r < BS; r++)
+        xk[r] -= L[cc*BS+r] * xi[cc];
+  }
+  blockLowerSolve<BS>(Lx + N->p[k]*bb, xk);
+}
+
+enum { CS_BLOCK_FACTORIZE = 0, CS_BLOCK_LSOLVE = 1, CS_BLOCK_LTSOLVE = 2 };
+
+/*
+ * one task of the etree schedule. The factorization and L\x process the nodes bottom up,
+ * a task is spawned once all its child tasks are done. L'\x processes them top down.
+ */
+template <int BS, typename T>
+struct BlockScheduleTask : public ThreadPool::Task
+{
+  int t, op;
+  const cs* A;
+  csbn* N;
+  const css* S;
+  int* c;
+  T* X;      ///< dense block workspace of the factorization
+  double* x; ///< right hand side of the solve
+  BlockScheduleTask<BS, T>* tasks;
+
+  virtual void run(ThreadPool& pool, int threadId)
+  {
+    cs_block_schedule* sched = N->sched;
+    int q;
+    switch (op) {
+      case CS_BLOCK_FACTORIZE: {
+        int* s = sched->stack + threadId * N->nb;
+        for (q = sched->Tp[t]; q < sched->Tp[t+1] && sched->ok; q++)
+          if (! blockcholrow<BS>(A, N, S, sched->Tnode[q], c, s, X))
+            sched->ok = 0;
+        break;
+      }
+      case CS_BLOCK_LSOLVE:
+        for (q = sched->Tp[t]; q < sched->Tp[t+1]; q++)
+          blocklsolverow<BS, T>(N, sched, sched->Tnode[q], x);
+        break;
+      case CS_BLOCK_LTSOLVE:
+        for (q = sched->Tp[t+1]-1; q >= sched->Tp[t]; q--)
+          blockltsolvecolumn<BS, T>(N, sched->Tnode[q], x);
+        for (q = sched->Tcp[t]; q < sched->Tcp[t+1]; q++)
+          pool.spawn(tasks + sched->Tci[q], threadId);
+        return;
+    }
+    int pt = sched->Tparent[t];
+    if (pt != -1 && __sync_sub_and_fetch(sched->pending + pt, 1) == 0)
+      pool.spawn(tasks + pt, threadId);
+  }
+};
+
+template <int BS, typename T>
+static int blockschedulerun(ThreadPool* pool, int op, const cs* A, csbn* N, const css* S, int* c, T* X, double* x)
+{
+  cs_block_schedule* sched = N->sched;
+  std::vector< BlockScheduleTask<BS, T> > tasks(sched->ntasks);
+  for (int t = 0; t < sched->ntasks; t++) {
+    BlockScheduleTask<BS, T>& task = tasks[t];
+    task.t = t; task.op = op;
+    task.A = A; task.N = N; task.S = S;
+    task.c = c; task.X = X; task.x = x;
+    task.tasks = &tasks[0];
+    sched->pending[t] = sched->Tcp[t+1] - sched->Tcp[t];
+  }
+  sched->ok = 1;
+  // collect the initial tasks first, the pending counters change once the first task runs
+  std::vector<int> ready;
+  for (int t = 0; t < sched->ntasks; t++)
+    if ((op == CS_BLOCK_LTSOLVE) ? sched->Tparent[t] == -1 : sched->pending[t] == 0)
+      ready.push_back(t);
+  for (size_t i = 0; i < ready.size(); i++)
+    pool->spawn(&tasks[ready[i]], i % pool->numThreads());
+  pool->wait();
+  return sched->ok;
+}
+
+/* the schedule of N for the pool, 0 if the serial code should be used */
+static cs_block_schedule* cs_blockschedule_pool(const css* S, csbn* N, ThreadPool* pool)
+{
+  const int minBlocks = 128; // below, the overhead of the tasks is larger than the gain
+  if (!pool || pool->numThreads() < 2 || N->nb < minBlocks) return (NULL) ;
+  if (!N->sched || N->sched->nthreads != pool->numThreads()) {
+    N->sched = cs_blocksfree (N->sched) ;
+    N->sched = cs_blockschedule (S, N, pool->numThreads()) ;
+  }
+  return (N->sched) ;
+}
+
+/* numeric factorization in the precision T of the values of N, xwork is re-used as nb*bs*bs T */
+template <typename T>
+static int blockcholnumeric(const cs* A, const css* S, csbn* N, int* work, T* xwork, ThreadPool* pool)
+{
+  if (cs_blockschedule_pool (S, N, pool)) {
+    int k, *c = work ;
+    for (k = 0 ; k < N->nb ; k++) c [k] = S->cp [k] ;
+    switch (N->bs) {
+      case 1: return blockschedulerun<1>(pool, CS_BLOCK_FACTORIZE, A, N, S, c, xwork, (double*) 0);
+      case 2: return blockschedulerun<2>(pool, CS_BLOCK_FACTORIZE, A, N, S, c, xwork, (double*) 0);
+      case 3: return blockschedulerun<3>(pool, CS_BLOCK_FACTORIZE, A, N, S, c, xwork, (double*) 0);
+      case 4: return blockschedulerun<4>(pool, CS_BLOCK_FACTORIZE, A, N, S, c, xwork, (double*) 0);
+      case 5: return blockschedulerun<5>(pool, CS_BLOCK_FACTORIZE, A, N, S, c, xwork, (double*) 0);
+      case 6: return blockschedulerun<6>(pool, CS_BLOCK_FACTORIZE, A, N, S, c, xwork, (double*) 0);
+    }
+  }
+  switch (N->bs) {
+    case 1: return blockchol<1>(A, N, S, work, xwork);
+    case 2: return blockchol<2>(A, N, S, work, xwork);
+    case 3: return blockchol<3>(A, N, S, work, xwork);
+    case 4: return blockchol<4>(A, N, S, work, xwork);
+    case 5: return blockchol<5>(A, N, S, work, xwork);
+    case 6: return blockchol<6>(A, N, S, work, xwork);
+    default:
+      fprintf(stderr, "%s: block size %d not supported\n", __PRETTY_FUNCTION__, N->bs);
+      return (0) ;
+  }
+}
+
+int cs_blockchol_numeric(const cs* A, const css* S, csbn* N, int* work, double* xwork, ThreadPool* pool)
+{
+  if (!CS_CSC (A) || !S || !N || !work || !xwork || A->n != N->nb * N->bs) return (0) ;
+  if (N->xf)
+    return blockcholnumeric (A, S, N, work, (float*) xwork, pool) ;
+  return blockcholnumeric (A, S, N, work, xwork, pool) ;
+}
+
+template <typename T>
+static void blocklsolvedispatch(const csbn* N, double* x, ThreadPool* pool)
+{
+  // the schedule is built by the parallel factorization
+  if (pool && pool->numThreads() > 1 && N->sched && N->sched->nthreads == pool->numThreads()) {
+    csbn* M = const_cast<csbn*>(N);
+    T* X = 0;
+    switch (N->bs) {
+      case 1: blockschedulerun<1>(pool, CS_BLOCK_LSOLVE, 0, M, 0, 0, X, x); return;
+      case 2: blockschedulerun<2>(pool, CS_BLOCK_LSOLVE, 0, M, 0, 0, X, x); return;
+      case 3: blockschedulerun<3>(pool, CS_BLOCK_LSOLVE, 0, M, 0, 0, X, x); return;
+      case 4: blockschedulerun<4>(pool, CS_BLOCK_LSOLVE, 0, M, 0, 0, X, x); return;
+      case 5: blockschedulerun<5>(pool, CS_BLOCK_LSOLVE, 0, M, 0, 0, X, x); return;
+      case 6: blockschedulerun<6>(pool, CS_BLOCK_LSOLVE, 0, M, 0, 0, X, x); return;
+    }
+  }
+  switch (N->bs) {
+    case 1: blocklsolve<1, T>(N, x); break;
+    case 2: blocklsolve<2, T>(N, x); break;
+    case 3: blocklsolve<3, T>(N, x); break;
+    case 4: blocklsolve<4, T>(N, x); break;
+    case 5: blocklsolve<5, T>(N, x); break;
+    case 6: blocklsolve<6, T>(N, x); break;
+  }
+}
+
+template <typename T>
+static void blockltsolvedispatch(const csbn* N, double* x, ThreadPool* pool)
+{
+  if (pool && pool->numThreads() > 1 && N->sched && N->sched->nthreads == pool->numThreads()) {
+    csbn* M = const_cast<csbn*>(N);
+    T* X = 0;
+    switch (N->bs) {
+      case 1: blockschedulerun<1>(pool, CS_BLOCK_LTSOLVE, 0, M, 0, 0, X, x); return;
+      case 2: blockschedulerun<2>(pool, CS_BLOCK_LTSOLVE, 0, M, 0, 0, X, x); return;
+      case 3: blockschedulerun<3>(pool, CS_BLOCK_LTSOLVE, 0, M, 0, 0, X, x); return;
+      case 4: blockschedulerun<4>(pool, CS_BLOCK_LTSOLVE, 0, M, 0, 0, X, x); return;
+      case 5: blockschedulerun<5>(pool, CS_BLOCK_LTSOLVE, 0, M, 0, 0, X, x); return;
+      case 6: blockschedulerun<6>(pool, CS_BLOCK_LTSOLVE, 0, M, 0, 0, X, x); return;
+    }
+  }
+  switch (N->bs) {
+    case 1: blockltsolve<1, T>(N, x); break;
+    case 2: blockltsolve<2, T>(N, x); break;
+    case 3: blockltsolve<3, T>(N, x); break;
+    case 4: blockltsolve<4, T>(N, x); break;
+    case 5: blockltsolve<5, T>(N, x); break;
+    case 6: blockltsolve<6, T>(N, x); break;
+  }
+}
+
+void cs_blocklsolve(const csbn* N, double* x, ThreadPool* pool)
+{
+  if (N->xf)
+    blocklsolvedispatch<float> (N, x, pool) ;
+  else
+    blocklsolvedispatch<double> (N, x, pool) ;
+}
+
+void cs_blockltsolve(const csbn* N, double* x, ThreadPool* pool)
+{
+  if (N->xf)
+    blockltsolvedispatch<float> (N, x, pool) ;
+  else
+    blockltsolvedispatch<double> (N, x, pool) ;
+}
+
+void cs_blockipvec(const int* pinv, const double* b, double* x, int nb, int bs)
+{
+  for (int k = 0; k < nb; k++) {
+    double* xk = x + (pinv ? pinv[k] : k) * bs;
+    const double* bk = b + k*bs;
+    for (int q = 0; q < bs; q++)
+      xk[q] = bk[q];
+  }
+}
+
+void cs_blockpvec(const int* pinv, const double* b, double* x, int nb, int bs)
+{
+  for (int k = 0; k < nb; k++) {
+    const double* bk = b + (pinv ? pinv[k] : k) * bs;
+    double* xk = x + k*bs;
+    for (int q = 0; q < bs; q++)
+      xk[q] = bk[q];
+  }
+}
+
+int cs_blockcholsolnumeric(const cs *A, double *b, const css* S, csbn* N, double* x, double* xwork, int* work,
+    ThreadPool* pool)
+{
+  int nb, bs ;
+  if (!CS_CSC (A) || !b || ! S || !N || !x) {
+    fprintf(stderr, "%s: No valid input!\n", __PRETTY_FUNCTION__);
+    assert(0); // get a backtrace in debug mode
+    return (0) ;     /* check inputs */
+  }
+  if (!cs_blockchol_numeric (A, S, N, work, xwork, pool)) {   /* numeric Cholesky factorization */
+    fprintf(stderr, "%s: cholesky failed!\n", __PRETTY_FUNCTION__);
+    return (0) ;
+  }
+  nb = N->nb ; bs = N->bs ;
+  cs_blockipvec (S->pinv, b, x, nb, bs) ;   /* x = P*b */
+  cs_blocklsolve (N, x, pool) ;             /* x = L\x */
+  cs_blockltsolve (N, x, pool) ;            /* x = L'\x */
+  cs_blockpvec (S->pinv, x, b, nb, bs) ;    /* b = P'*x */
+  return (1) ;
+}
+
+int cs_blockcholsolinvblocknumeric(const cs *A, double **block, int r1, int c1, int r2,int c2, double* y, const css* S, csbn* N,
+    double* x, double* b, double* temp, double* xwork, int* work, ThreadPool* pool)
+{
+  int n, nb, bs, i, j ;
+  if (!CS_CSC (A) || !block || !y || !x || !b || !temp || !N) return (0) ;     /* check inputs */
+  n = A->n ;
+  if(r2<=r1||c2<=c1) return (0);
+  if(c1<0 || c2>n)
+    return 0;
+  if(r1<0 || r2>n)
+    return 0;
+
+  if (!cs_blockchol_numeric (A, S, N, work, xwork, pool))   /* numeric Cholesky factorization */
+    return (0) ;
+  nb = N->nb ; bs = N->bs ;
+
+  // solve the system
+  cs_blockipvec (S->pinv, y, x, nb, bs) ;   /* x = P*y */
+  cs_blocklsolve (N, x, pool) ;             /* x = L\x */
+  cs_blockltsolve (N, x, pool) ;            /* x = L'\x */
+  cs_blockpvec (S->pinv, x, y, nb, bs) ;    /* y = P'*x */
+  // solve the inverse
+
+  for (i=0; i<n; i++){
+    b[i]=0.;
+  }
+  for (i=c1; i<c2; i++){
+    b[i]=1.;
+
+    cs_blockipvec (S->pinv, b, x, nb, bs) ;    /* x = P*b */
+    cs_blocklsolve (N, x, pool) ;              /* x = L\x */
+    cs_blockltsolve (N, x, pool) ;             /* x = L'\x */
+    cs_blockpvec (S->pinv, x, temp, nb, bs) ;  /* temp = P'*x */
+    for (j=r1; j<r2; j++){
+      block[j-r1][i-c1]=temp[j];
+    }
+    b[i]=0.;
+  }
+  return (1) ;
+}
+
+/*
+ * column j of the sparse inverse Sigma, the columns of the ancestors of j have to be done.
+ * From Sigma*L = L^-T follows with Y(k) = L(k,j)*L(j,j)^-1 for the rows k>j of the column
+ *   Sigma(i,j) = -sum_k Sigma(i,k)*Y(k)
+ *   Sigma(j,j) = L(j,j)^-T*L(j,j)^-1 - sum_k Sigma(k,j)'*Y(k)
+ * and all the required Sigma(i,k) are on the pattern of L.
+ */
+template <int BS>
+static void blocksparseinvcolumn(const csbn* N, int j, double* Sigma, double* Y)
+{
+  const int bb = BS*BS;
+  const int *Lp = N->p, *Li = N->i;
+  const double* Lx = N->x;
+  int m = Lp[j+1] - Lp[j] - 1;
+  const int* R = Li + Lp[j] + 1;
+  double Linv[bb];
+  int a, b, p, r, c, q;
+
+  // Linv = L(j,j)^-1
+  for (q = 0; q < bb; q++) Linv[q] = 0.;
+  for (c = 0; c < BS; c++) {
+    Linv[c*BS+c] = 1.;
+    blockLowerSolve<BS>(Lx + Lp[j]*bb, Linv + c*BS);
+  }
+  // Y(a) = L(R[a],j)*Linv, Sigma(R[a],j) = 0
+  for (a = 0; a < m; a++) {
+    const double* L = Lx + (Lp[j]+1+a)*bb;
+    double* Ya = Y + a*bb;
+    for (c = 0; c < BS; c++)
+      for (r = 0; r < BS; r++) {
+        double v = 0.;
+        for (q = c; q < BS; q++)  // Linv is lower triangular
+          v += L[q*BS+r] * Linv[c*BS+q];
+        Ya[c*BS+r] = v;
+      }
+    double* Sa = Sigma + (Lp[j]+1+a)*bb;
+    for (q = 0; q < bb; q++) Sa[q] = 0.;
+  }
+  for (a = 0; a < m; a++) {
+    int k = R[a];
+    const double* Ya = Y + a*bb;
+    double* Sa = Sigma + (Lp[j]+1+a)*bb;
+    // Sigma(k,j) -= Sigma(k,k)*Y(a)
+    const double* Skk = Sigma + Lp[k]*bb;
+    for (c = 0; c < BS; c++)
+      for (r = 0; r < BS; r++) {
+        double v = 0.;
+        for (q = 0; q < BS; q++)
+          v += Skk[q*BS+r] * Ya[c*BS+q];
+        Sa[c*BS+r] -= v;
+      }
+    // the rows R[b]>k of the column k, b>a, hold Sigma(R[b],k)
+    p = Lp[k] + 1;
+    for (b = a+1; b < m; b++) {
+      while (Li[p] < R[b]) p++;
+      const double* Sbk = Sigma + p*bb;
+      const double* Yb = Y + b*bb;
+      double* Sb = Sigma + (Lp[j]+1+b)*bb;
+      for (c = 0; c < BS; c++)
+        for (r = 0; r < BS; r++) {
+          double v = 0., w = 0.;
+          for (q = 0; q < BS; q++) {
+            v += Sbk[q*BS+r] * Ya[c*BS+q];  // Sigma(R[b],k)*Y(a)
+            w += Sbk[r*BS+q] * Yb[c*BS+q];  // Sigma(R[b],k)'*Y(b)
+          }
+          Sb[c*BS+r] -= v;
+          Sa[c*BS+r] -= w;
+        }
+    }
+  }
+  // Sigma(j,j)
+  double* Sjj = Sigma + Lp[j]*bb;
+  for (c = 0; c < BS; c++)
+    for (r = 0; r < BS; r++) {
+      double v = 0.;
+      for (q = CS_MAX(r, c); q < BS; q++)
+        v += Linv[r*BS+q] * Linv[c*BS+q];
+      for (a = 0; a < m; a++) {
+        const double* Sa = Sigma + (Lp[j]+1+a)*bb;
+        const double* Ya = Y + a*bb;
+        for (q = 0; q < BS; q++)
+          v -= Sa[r*BS+q] * Ya[c*BS+q];
+      }
+      Sjj[c*BS+r] = v;
+    }
+}
+
+template <int BS>
+static void blocksparseinv(const csbn* N, const int* parent, int j, double* Sigma, double* Y, int* path, char* done)
+{
+  int k, len;
+  if (j < 0) {
+    for (k = N->nb-1; k >= 0; k--) {
+      if (done && done[k]) continue;
+      blocksparseinvcolumn<BS>(N, k, Sigma, Y);
+      if (done) done[k] = 1;
+    }
+    return;
+  }
+  // the ancestors of a computed column are computed as well
+  for (len = 0, k = j; k != -1 && !(done && done[k]); k = parent[k])
+    path[len++] = k;
+  while (len > 0) {
+    k = path[--len];
+    blocksparseinvcolumn<BS>(N, k, Sigma, Y);
+    if (done) done[k] = 1;
+  }
+}
+
+void cs_blocksparseinv(const csbn* N, const int* parent, int j, double* Sigma, double* xwork, int* work, char* done)
+{
+  assert(N->x && "the sparse inverse requires a double precision factor");
+  switch (N->bs) {
+    case 1: blocksparseinv<1>(N, parent, j, Sigma, xwork, work, done); break;
+    case 2: blocksparseinv<2>(N, parent, j, Sigma, xwork, work, done); break;
+    case 3: blocksparseinv<3>(N, parent, j, Sigma, xwork, work, done); break;
+    case 4: blocksparseinv<4>(N, parent, j, Sigma, xwork, work, done); break;
+    case 5: blocksparseinv<5>(N, parent, j, Sigma, xwork, work, done); break;
+    case 6: blocksparseinv<6>(N, parent, j, Sigma, xwork, work, done); break;
+  }
+}
+
+int cs_blockfind(const csbn* N, int r, int c)
+{
+  // the rows of a column of L are sorted
+  const int* begin = N->i + N->p [c] ;
+  const int* end = N->i + N->p [c+1] ;
+  const int* it = std::lower_bound (begin, end, r) ;
+  return (it != end && *it == r) ? (int) (it - N->i) : -1 ;
+}
+
+int cs_blockcholsolinvdiagnumeric(const cs *A, double **block, int J, double* y, const css* S, csbn* N,
+    double* x, double* xwork, int* work, double* Sigma, ThreadPool* pool)
+{
+  int j, bs, bb, r, c ;
+  if (!block || !Sigma || J < 0 || J >= A->n / N->bs) return (0) ;
+  if (!cs_blockcholsolnumeric (A, y, S, N, x, xwork, work, pool)) return (0) ;
+  bs = N->bs ; bb = bs*bs ;
+  j = S->pinv ? S->pinv [J] : J ;
+  cs_blocksparseinv (N, S->parent, j, Sigma, xwork, work) ;
+  const double* Sjj = Sigma + N->p [j]*bb ;
+  for (c = 0 ; c < bs ; c++)
+    for (r = 0 ; r < bs ; r++)
+      block [r][c] = Sjj [c*bs+r] ;
+  return (1) ;
+}
+
+void cs_blockdense_lower(const cs* A, int bs, double* D, char* nz)
+{
+  int n = A->n, nb = n / bs, bb = bs*bs ;
+  const int *Ap = A->p, *Ai = A->i ;
+  const double* Ax = A->x ;
+  /* only the blocks flagged in nz are cleared */
+  memset (nz, 0, nb*nb) ;
+  for (int c = 0 ; c < n ; c++)
+    for (int p = Ap [c] ; p < Ap [c+1] ; p++) {
+      int r = Ai [p] ;  /* A(r,c), r<=c, is L(c,r) */
+      int q = (r/bs)*nb + c/bs ;
+      if (!nz [q]) {
+        memset (D + q*bb, 0, bb*sizeof(double)) ;
+        nz [q] = 1 ;
+      }
+      D [q*bb + (r%bs)*bs + c%bs] = Ax [p] ;
+    }
+}
+
+/* X -= A*B' for BS x BS blocks */
+template <int BS>
+static inline void blockSubtractABt(double* X, const double* A, const double* B)
+{
+  for (int c = 0 ; c < BS ; c++)
+    for (int q = 0 ; q < BS ; q++) {
+      const double b = B [q*BS+c] ;
+      for (int r = 0 ; r < BS ; r++)
+        X [c*BS+r] -= A [q*BS+r] * b ;
+    }
+}
+
+template <int BS>
+static int blockdensechol(double* D, int nb, char* nz, int nm)
+{
+  const int bb = BS*BS;
+  double y[BS];
+  /* blocks which are zero in A and not filled in are skipped */
+  for (int j = 0 ; j < nm ; j++) {
+    double* Djj = D + (j*nb+j)*bb ;
+    for (int k = 0 ; k < j ; k++)
+      if (nz [k*nb+j])
+        blockSubtractABt<BS> (Djj, D + (k*nb+j)*bb, D + (k*nb+j)*bb) ;
+    if (!blockCholesky<BS> (Djj))
+      return (0) ;
+    for (int i = j+1 ; i < nb ; i++) {
+      double* Dij = D + (j*nb+i)*bb ;
+      for (int k = 0 ; k < j ; k++)
+        if (nz [k*nb+i] && nz [k*nb+j]) {
+          if (!nz [j*nb+i]) {  /* fill in */
+            memset (Dij, 0, bb*sizeof(double)) ;
+            nz [j*nb+i] = 1 ;
+          }
+          blockSubtractABt<BS> (Dij, D + (k*nb+i)*bb, D + (k*nb+j)*bb) ;
+        }
+      if (!nz [j*nb+i])
+        continue ;
+      /* L(i,j) = D(i,j)*L(j,j)^-T, row by row */
+      for (int r = 0 ; r < BS ; r++) {
+        for (int c = 0 ; c < BS ; c++) y [c] = Dij [c*BS+r] ;
+        blockLowerSolve<BS> (Djj, y) ;
+        for (int c = 0 ; c < BS ; c++) Dij [c*BS+r] = y [c] ;
+      }
+    }
+  }
+  /* the trailing block columns are updated by the factored ones only */
+  for (int j = nm ; j < nb ; j++)
+    for (int i = j ; i < nb ; i++) {
+      double* Dij = D + (j*nb+i)*bb ;
+      for (int k = 0 ; k < nm ; k++)
+        if (nz [k*nb+i] && nz [k*nb+j]) {
+          if (!nz [j*nb+i]) {
+            memset (Dij, 0, bb*sizeof(double)) ;
+            nz [j*nb+i] = 1 ;
+          }
+          blockSubtractABt<BS> (Dij, D + (k*nb+i)*bb, D + (k*nb+j)*bb) ;
+        }
+    }
+  return (1) ;
+}
+
+template <int BS>
+static void blockdenselsolve(const double* L, int nb, const char* nz, double* x, int first, int last)
+{
+  const int bb = BS*BS;
+  for (int j = first ; j < last ; j++) {
+    double* xj = x + j*BS ;
+    blockLowerSolve<BS> (L + (j*nb+j)*bb, xj) ;
+    for (int i = j+1 ; i < nb ; i++) {
+      if (!nz [j*nb+i]) continue ;
+      const double* Lij = L + (j*nb+i)*bb ;
+      double* xi = x + i*BS ;
+      for (int c = 0 ; c < BS ; c++)
+        for (int r = 0 ; r < BS ; r++)
+          xi [r] -= Lij [c*BS+r] * xj [c] ;
+    }
+  }
+}
+
+template <int BS>
+static void blockdensesolve(const double* L, int nb, const char* nz, double* x)
+{
+  const int bb = BS*BS;
+  blockdenselsolve<BS> (L, nb, nz, x, 0, nb) ;
+  for (int j = nb-1 ; j >= 0 ; j--) {
+    double* xj = x + j*BS ;
+    for (int i = j+1 ; i < nb ; i++) {
+      if (!nz [j*nb+i]) continue ;
+      const double* Lij = L + (j*nb+i)*bb ;
+      const double* xi = x + i*BS ;
+      for (int c = 0 ; c < BS ; c++)
+        for (int r = 0 ; r < BS ; r++)
+          xj [c] -= Lij [c*BS+r] * xi [r] ;
+    }
+    blockLowerTransposedSolve<BS> (L + (j*nb+j)*bb, xj) ;
+  }
+}
+
+void cs_blockdenselsolve(const double* L, int nb, int bs, const char* nz, double* x, int first)
+{
+  switch (bs) {
+    case 1: blockdenselsolve<1>(L, nb, nz, x, first, nb); break;
+    case 2: blockdenselsolve<2>(L, nb, nz, x, first, nb); break;
+    case 3: blockdenselsolve<3>(L, nb, nz, x, first, nb); break;
+    case 4: blockdenselsolve<4>(L, nb, nz, x, first, nb); break;
+    case 5: blockdenselsolve<5>(L, nb, nz, x, first, nb); break;
+    case 6: blockdenselsolve<6>(L, nb, nz, x, first, nb); break;
+  }
+}
+
+int cs_blockdensechol(double* D, int nb, int bs, char* nz)
+{
+  switch (bs) {
+    case 1: return blockdensechol<1>(D, nb, nz, nb);
+    case 2: return blockdensechol<2>(D, nb, nz, nb);
+    case 3: return blockdensechol<3>(D, nb, nz, nb);
+    case 4: return blockdensechol<4>(D, nb, nz, nb);
+    case 5: return blockdensechol<5>(D, nb, nz, nb);
+    case 6: return blockdensechol<6>(D, nb, nz, nb);
+    default:
+      fprintf(stderr, "%s: block size %d not supported\n", __PRETTY_FUNCTION__, bs);
+      return (0) ;
+  }
+}
+
+template <int BS>
+static int blockdenseschur(double* D, int nb, int nm, char* nz, double* x)
+{
+  if (!blockdensechol<BS> (D, nb, nz, nm))
+    return (0) ;
+  blockdenselsolve<BS> (D, nb, nz, x, 0, nm) ;
+  return (1) ;
+}
+
+int cs_blockdenseschur(double* D, int nb, int nm, int bs, char* nz, double* x)
+{
+  switch (bs) {
+    case 1: return blockdenseschur<1>(D, nb, nm, nz, x);
+    case 2: return blockdenseschur<2>(D, nb, nm, nz, x);
+    case 3: return blockdenseschur<3>(D, nb, nm, nz, x);
+    case 4: return blockdenseschur<4>(D, nb, nm, nz, x);
+    case 5: return blockdenseschur<5>(D, nb, nm, nz, x);
+    case 6: return blockdenseschur<6>(D, nb, nm, nz, x);
+    default:
+      fprintf(stderr, "%s: block size %d not supported\n", __PRETTY_FUNCTION__, bs);
+      return (0) ;
+  }
+}
+
+void cs_blockdensesolve(const double* L, int nb, int bs, const char* nz, double* x)
+{
+  switch (bs) {
+    case 1: blockdensesolve<1>(L, nb, nz, x); break;
+    case 2: blockdensesolve<2>(L, nb, nz, x); break;
+    case 3: blockdensesolve<3>(L, nb, nz, x); break;
+    case 4: blockdensesolve<4>(L, nb, nz, x); break;
+    case 5: blockdensesolve<5>(L, nb, nz, x); break;
+    case 6: blockdensesolve<6>(L, nb, nz, x); break;
+  }
+}
+
+void cs_symupper_gaxpy(const cs* A, const double* x, double* y)
+{
+  int n = A->n ;
+  const int *Ap = A->p, *Ai = A->i ;
+  const double* Ax = A->x ;
+  for (int j = 0 ; j < n ; j++) {
+    double xj = x [j], yj = 0. ;
+    for (int p = Ap [j] ; p < Ap [j+1] ; p++) {
+      int i = Ai [p] ;
+      y [i] += Ax [p] * xj ;
+      if (i != j) yj += Ax [p] * x [i] ;
+    }
+    y [j] += yj ;
+  }
+}
+
+/* z = M^-1 r for the block diagonal preconditioner */
+static void blockjacobi(const double* Minv, const double* r, double* z, int n, int bs)
+{
+  const int bb = bs*bs ;
+  for (int k = 0 ; k < n ; k += bs) {
+    const double* M = Minv + (k/bs)*bb ;
+    for (int q = 0 ; q < bs ; q++) {
+      double v = 0. ;
+      for (int c = 0 ; c < bs ; c++)
+        v += M [c*bs+q] * r [k+c] ;
+      z [k+q] = v ;
+    }
+  }
+}
+
+static double dot(const double* a, const double* b, int n)
+{
+  double v = 0. ;
+  for (int i = 0 ; i < n ; i++) v += a [i] * b [i] ;
+  return v ;
+}
+
+int cs_blockpcg(const cs* A, const double* b, double* x, const double* Minv, int bs,
+    double tolerance, int maxIterations, double* work, double* residual)
+{
+  int n, i, it ;
+  double *r, *z, *p, *q, rz, bnorm, rnorm ;
+  if (!CS_CSC (A) || !b || !x || !Minv || !work || bs <= 0) return (-1) ;
+  n = A->n ;
+  r = work ; z = work + n ; p = work + 2*n ; q = work + 3*n ;
+  // r = b - A*x
+  for (i = 0 ; i < n ; i++) q [i] = 0. ;
+  cs_symupper_gaxpy (A, x, q) ;
+  for (i = 0 ; i < n ; i++) r [i] = b [i] - q [i] ;
+  bnorm = sqrt (dot (b, b, n)) ;
+  rnorm = sqrt (dot (r, r, n)) ;
+  if (bnorm == 0.) bnorm = 1. ;
+  blockjacobi (Minv, r, z, n, bs) ;
+  for (i = 0 ; i < n ; i++) p [i] = z [i] ;
+  rz = dot (r, z, n) ;
+  for (it = 0 ; it < maxIterations && rnorm > tolerance * bnorm ; it++) {
+    for (i = 0 ; i < n ; i++) q [i] = 0. ;
+    cs_symupper_gaxpy (A, p, q) ;
+    double pq = dot (p, q, n) ;
+    if (pq <= 0.) return (-1) ;
+    double alpha = rz / pq ;
+    for (i = 0 ; i < n ; i++) {
+      x [i] += alpha * p [i] ;
+      r [i] -= alpha * q [i] ;
+    }
+    rnorm = sqrt (dot (r, r, n)) ;
+    blockjacobi (Minv, r, z, n, bs) ;
+    double rzNew = dot (r, z, n) ;
+    double beta = rzNew / rz ;
+    rz = rzNew ;
+    for (i = 0 ; i < n ; i++) p [i] = z [i] + beta * p [i] ;
+  }
+  if (residual) *residual = rnorm / bnorm ;
+  return (it) ;
+}
+
+/* z = (L*L')^-1 r for the factor N of P*A*P', x is a workspace of n doubles */
+static void blockcholprecond(const css* S, const csbn* N, const double* r, double* z, double* x, ThreadPool* pool)
+{
+  cs_blockipvec (S->pinv, r, x, N->nb, N->bs) ;
+  cs_blocklsolve (N, x, pool) ;
+  cs_blockltsolve (N, x, pool) ;
+  cs_blockpvec (S->pinv, x, z, N->nb, N->bs) ;
+}
+
+int cs_blockcholsolrefine(const cs *A, double *b, const css* S, csbn* N, double* x, double* xwork, int* work,
+    int maxIterations, double tolerance, double* rwork, ThreadPool* pool)
+{
+  int n, i, it ;
+  double *y, *r, *p, *q, rz, bnorm, rnorm ;
+  if (!CS_CSC (A) || !b || !S || !N || !N->xf || !x || !xwork || !rwork) return (-1) ;
+  if (!cs_blockchol_numeric (A, S, N, work, xwork, pool))   /* single precision factorization */
+    return (-1) ;
+  n = A->n ;
+  y = rwork ; r = rwork + n ; p = rwork + 2*n ; q = rwork + 3*n ;
+  // y=0, r=b. The first step is the plain solve by the single precision factor
+  for (i = 0 ; i < n ; i++) {
+    y [i] = 0. ;
+    r [i] = b [i] ;
+  }
+  bnorm = rnorm = sqrt (dot (b, b, n)) ;
+  if (bnorm == 0.) bnorm = 1. ;
+  blockcholprecond (S, N, r, p, x, pool) ;
+  rz = dot (r, p, n) ;
+  for (it = 0 ; rnorm > tolerance * bnorm ; it++) {
+    // the single precision factor is too inaccurate for the condition of A
+    if (it == maxIterations) return (-1) ;
+    for (i = 0 ; i < n ; i++) q [i] = 0. ;
+    cs_symupper_gaxpy (A, p, q) ;
+    double pq = dot (p, q, n) ;
+    if (pq <= 0.) return (-1) ;
+    double alpha = rz / pq ;
+    for (i = 0 ; i < n ; i++) {
+      y [i] += alpha * p [i] ;
+      r [i] -= alpha * q [i] ;
+    }
+    rnorm = sqrt (dot (r, r, n)) ;
+    blockcholprecond (S, N, r, q, x, pool) ;   // q is free until the next product
+    double rzNew = dot (r, q, n) ;
+    double beta = rzNew / rz ;
+    rz = rzNew ;
+    for (i = 0 ; i < n ; i++) p [i] = q [i] + beta * p [i] ;
+  }
+  for (i = 0 ; i < n ; i++) b [i] = y [i] ;
+  return (it) ;
+}
+
 } // end namespace
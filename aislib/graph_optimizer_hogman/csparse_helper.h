@@ -23,6 +23,8 @@ extern "C" {
 #include <EXTERNAL/csparse/cs.h>
 };
 
+class ThreadPool;
+
 namespace AISNavigation {
 
 struct SparseMatrixEntry{
@@ -109,11 +111,298 @@ inline cs_sparse* SparseMatrixEntryPtrVector2CSparse(SparseMatrixEntry** entries
   return _csA;
 }
 
+/**
+ * allocate the upper triangular part of a symmetric block matrix in column compressed form.
+ * blockRows[j] contains the sorted block rows i<=j of the block column j, the last entry has to be j.
+ * All the columns of a block column share the same row pattern, an off-diagonal block is therefore
+ * addressed by the offset of its first row within the column, see cs_blockoffset().
+ * The diagonal block only stores its upper triangle. If A is given and large enough it is re-used.
+ */
+inline cs_sparse* cs_blockpattern_upper(const std::vector< std::vector<int> >& blockRows, int dim, cs_sparse* A=0)
+{
+  int nBlocks=blockRows.size();
+  int n=nBlocks*dim;
+  int nz=0;
+  for (int j=0; j<nBlocks; j++){
+    nz+=(blockRows[j].size()-1)*dim*dim + dim*(dim+1)/2;
+  }
+  if (A && (A->nzmax<nz || A->m<n)){
+    cs_spfree(A);
+    A=0;
+  }
+  if (! A){
+    A=cs_spalloc(2*n, 2*n, 2*nz, 1, 0);
+    if (! A)
+      return 0;
+  }
+  A->m=n;
+  A->n=n;
+  int* Ap=A->p;
+  int* Ai=A->i;
+  nz=0;
+  for (int j=0; j<nBlocks; j++){
+    const std::vector<int>& rows=blockRows[j];
+    for (int k=0; k<dim; k++){
+      Ap[j*dim+k]=nz;
+      for (size_t q=0; q<rows.size()-1; q++){
+        for (int r=0; r<dim; r++){
+          Ai[nz++]=rows[q]*dim+r;
+        }
+      }
+      for (int r=0; r<=k; r++){
+        Ai[nz++]=j*dim+r;
+      }
+    }
+  }
+  Ap[n]=nz;
+  std::fill(A->x, A->x+nz, 0.);
+  return A;
+}
+
+/**
+ * offset of the block (r,c), r<=c, within the columns of the block column c
+ */
+inline int cs_blockoffset(const std::vector< std::vector<int> >& blockRows, int r, int c, int dim)
+{
+  const std::vector<int>& rows=blockRows[c];
+  return (std::lower_bound(rows.begin(), rows.end(), r)-rows.begin())*dim;
+}
+
+/**
+ * add the dim x dim block m to the block (r,c) of a matrix allocated with cs_blockpattern_upper().
+ * offset is the one of the block stored in the upper triangle, i.e. (min(r,c), max(r,c)). If r>c the
+ * block is stored transposed, if r==c only the upper triangle of m is used.
+ */
+template <typename MatrixType>
+inline void cs_blockadd_upper(cs_sparse* A, int r, int c, int offset, const MatrixType& m, int dim)
+{
+  double* Ax=A->x;
+  const int* Ap=A->p;
+  if (r<c){
+    for (int k=0; k<dim; k++){
+      double* column=Ax+Ap[c*dim+k]+offset;
+      for (int q=0; q<dim; q++)
+        column[q]+=m[q][k];
+    }
+  } else if (r>c){
+    for (int k=0; k<dim; k++){
+      double* column=Ax+Ap[r*dim+k]+offset;
+      for (int q=0; q<dim; q++)
+        column[q]+=m[k][q];
+    }
+  } else {
+    for (int k=0; k<dim; k++){
+      double* column=Ax+Ap[c*dim+k]+offset;
+      for (int q=0; q<=k; q++)
+        column[q]+=m[q][k];
+    }
+  }
+}
+
+/**
+ * copy the diagonal block (c,c) of a matrix allocated with cs_blockpattern_upper() into m
+ */
+template <typename MatrixType>
+inline void cs_blockget_diagonal(const cs_sparse* A, int c, int offset, MatrixType& m, int dim)
+{
+  const double* Ax=A->x;
+  const int* Ap=A->p;
+  for (int k=0; k<dim; k++){
+    const double* column=Ax+Ap[c*dim+k]+offset;
+    for (int q=0; q<=k; q++)
+      m[q][k]=m[k][q]=column[q];
+  }
+}
+
+/**
+ * A+=mu*I for a matrix allocated with cs_blockpattern_upper(), the diagonal entry is the last one of each column
+ */
+inline void cs_adddiagonal_upper(cs_sparse* A, double mu)
+{
+  for (int j=0; j<A->n; j++)
+    A->x[A->p[j+1]-1]+=mu;
+}
+
+/**
+ * largest diagonal entry of a matrix allocated with cs_blockpattern_upper()
+ */
+inline double cs_maxdiagonal_upper(const cs_sparse* A)
+{
+  double m=0.;
+  for (int j=0; j<A->n; j++)
+    m=std::max(m, A->x[A->p[j+1]-1]);
+  return m;
+}
+
 // our extensions to csparse
 csn* cs_chol_workspace (const cs *A, const css *S, int* cin, double* xin);
 int cs_cholsolsymb(const cs *A, double *b, const css* S, double* workspace, int* work);
 int cs_cholsolinvblocksymb(const cs *A, double **block, int r1, int c1, int r2,int c2, double* y, const css* S, double* x, double* b, double* temp, int* work);
 
+/**
+ * numeric cholesky factor consisting of dense bs x bs blocks. The block columns are stored
+ * like the columns of a cs matrix, the first block of each column is the (lower triangular)
+ * diagonal block. Each block is stored in column major order.
+ * Besides L the structure keeps the permuted block pattern C=P*A*P' together with the
+ * location of each block of C inside A. Hence, as long as the pattern of A and the symbolic
+ * analysis do not change, the factorization can be recomputed in place by cs_blockchol_numeric().
+ */
+typedef struct cs_block_numeric
+{
+  int nb;     ///< number of block columns
+  int bs;     ///< dimension of a block
+  int* p;     ///< block column pointers (size nb+1)
+  int* i;     ///< block row indices
+  double* x;  ///< values, bs*bs per block, NULL for a single precision factor
+  float* xf;  ///< values of a single precision factor, NULL otherwise
+  int nbmax;  ///< allocated number of block columns
+  int lnzmax; ///< allocated number of blocks in L
+  cs* C;      ///< block pattern of P*A*P', upper triangle
+  int* Cj;    ///< block column in A of each block of C
+  int* Coff;  ///< offset of each block of C inside the columns of its block column in A
+  int* Cmode; ///< CS_BLOCK_DIAGONAL, CS_BLOCK_UPPER or CS_BLOCK_TRANSPOSED
+  struct cs_block_schedule* sched; ///< tasks of the parallel factorization, built on demand
+} csbn;
+
+enum { CS_BLOCK_DIAGONAL = 0, CS_BLOCK_UPPER = 1, CS_BLOCK_TRANSPOSED = 2 };
+
+/**
+ * fill reducing orderings of cs_blockorder()
+ */
+enum {
+  CS_ORDER_NATURAL = 0,           ///< no permutation
+  CS_ORDER_AMD = 1,               ///< approximate minimum degree on A+A'
+  CS_ORDER_NESTED_DISSECTION = 2  ///< recursive bisection by level sets, AMD on the small parts
+};
+
+/**
+ * fill reducing permutation of the block columns of a matrix allocated by cs_blockpattern_upper(),
+ * P[k] is the block column eliminated in the k-th step. The result has to be freed by cs_free(),
+ * it is NULL for the natural ordering.
+ */
+int* cs_blockorder(int order, const cs* A, int bs);
+
+/**
+ * ordering and symbolic analysis of a matrix allocated by cs_blockpattern_upper().
+ * The analysis is carried out on the block pattern, hence pinv, parent and cp of the
+ * result refer to block columns.
+ */
+css* cs_blockschol(int order, const cs* A, int bs);
+/**
+ * symbolic analysis for the given permutation P of the block columns, see cs_blockorder().
+ * P may be NULL for the natural ordering.
+ */
+css* cs_blockschol_perm(const int* P, const cs* A, int bs);
+/**
+ * size of the factor and estimated flops of the numeric factorization for the analysis S,
+ * counted in scalar entries of the dense blocks.
+ */
+void cs_blockcholstats(const css* S, int nb, int bs, double* nnzL, double* flops);
+
+/**
+ * allocates the block factor for A analysed by cs_blockschol(), no numeric values are computed.
+ * If N is given, its storage is re-used if large enough and of the same precision, otherwise it is freed.
+ * If single is set, the values are stored in single precision (xf instead of x). Such a factor is computed
+ * in single precision, the solves read it in single precision and accumulate in the double right hand side.
+ */
+csbn* cs_blockchol_alloc(const cs* A, const css* S, int bs, csbn* N=0, int single=0);
+/**
+ * numeric cholesky factorization of A into the storage of N, no memory is allocated.
+ * work has to hold 2*nb ints and xwork nb*bs*bs doubles, nb=A->n/bs.
+ * If a pool with more than one thread is given, independent subtrees of the elimination
+ * tree are factorized concurrently. The result is identical to the serial one.
+ * @return 1 on success, 0 if A is not positive definite
+ */
+int cs_blockchol_numeric(const cs* A, const css* S, csbn* N, int* work, double* xwork, ThreadPool* pool=0);
+csbn* cs_blocknfree(csbn* N);
+/** x=L\x, runs on the etree schedule if N was factorized with the same pool */
+void cs_blocklsolve(const csbn* N, double* x, ThreadPool* pool=0);
+/** x=L'\x, runs on the etree schedule if N was factorized with the same pool */
+void cs_blockltsolve(const csbn* N, double* x, ThreadPool* pool=0);
+/** x=P*b, pinv is the block permutation */
+void cs_blockipvec(const int* pinv, const double* b, double* x, int nb, int bs);
+/** x=P'*b, pinv is the block permutation */
+void cs_blockpvec(const int* pinv, const double* b, double* x, int nb, int bs);
+
+/**
+ * block counterparts of cs_cholsolsymb() and cs_cholsolinvblocksymb() which refactorize A into
+ * the pre-allocated N, x has to hold n doubles, xwork nb*bs*bs doubles and work 2*nb ints.
+ */
+int cs_blockcholsolnumeric(const cs *A, double *b, const css* S, csbn* N, double* x, double* xwork, int* work,
+    ThreadPool* pool=0);
+int cs_blockcholsolinvblocknumeric(const cs *A, double **block, int r1, int c1, int r2,int c2, double* y, const css* S, csbn* N,
+    double* x, double* b, double* temp, double* xwork, int* work, ThreadPool* pool=0);
+
+/**
+ * sparse inverse (Takahashi recursion): computes the blocks of (L*L')^-1 on the pattern of L
+ * and stores them like the blocks of L in Sigma, which has to hold N->p[nb]*bs*bs doubles.
+ * If j>=0, only the block columns on the path from the block column j to the root of the
+ * elimination tree are computed, this suffices for the diagonal block j. The blocks refer to
+ * the permuted matrix, i.e., block j of the result is block S->pinv^-1[j] of A^-1.
+ * xwork has to hold nb*bs*bs doubles and work nb ints.
+ * If done is given, the columns flagged in done are not recomputed and the computed ones are flagged,
+ * this allows to extend the inverse of one factor by successive calls. N has to be a double precision factor.
+ */
+void cs_blocksparseinv(const csbn* N, const int* parent, int j, double* Sigma, double* xwork, int* work, char* done=0);
+/**
+ * position of the block (r,c), r>=c, in the block factor N, -1 if it is not on the pattern of L
+ */
+int cs_blockfind(const csbn* N, int r, int c);
+
+/**
+ * solves A*y=b like cs_blockcholsolnumeric() and computes the diagonal block J of A^-1 by
+ * cs_blocksparseinv(), block[r][c] receives its entries. Sigma is the storage for the sparse inverse.
+ */
+int cs_blockcholsolinvdiagnumeric(const cs *A, double **block, int J, double* y, const css* S, csbn* N,
+    double* x, double* xwork, int* work, double* Sigma, ThreadPool* pool=0);
+
+/**
+ * dense block cholesky for small systems. D stores the lower triangle of a nb x nb block matrix,
+ * block (i,j), i>=j, at D+(j*nb+i)*bs*bs in column major order, the blocks above the diagonal are
+ * not referenced. nz flags the non zero blocks at the same index j*nb+i, zero blocks are skipped.
+ * cs_blockdense_lower() scatters the upper triangle of A into D, the blocks not flagged are undefined.
+ */
+void cs_blockdense_lower(const cs* A, int bs, double* D, char* nz);
+/** in place cholesky factorization of D, nz is updated by the fill in. Returns 0 if D is not positive definite */
+int cs_blockdensechol(double* D, int nb, int bs, char* nz);
+/** x=L\x, the blocks of x before the block first have to be zero */
+void cs_blockdenselsolve(const double* L, int nb, int bs, const char* nz, double* x, int first=0);
+/** x=(L*L')\x for the factor computed by cs_blockdensechol() */
+void cs_blockdensesolve(const double* L, int nb, int bs, const char* nz, double* x);
+/**
+ * factorizes only the first nm block columns of D. The trailing blocks are replaced by the schur
+ * complement of the leading nm x nm block, the trailing blocks of x by the reduced right hand side
+ * and the leading ones by L\x. Returns 0 if the leading block is not positive definite
+ */
+int cs_blockdenseschur(double* D, int nb, int nm, int bs, char* nz, double* x);
+
+/** y+=A*x for a symmetric A of which only the upper triangle is stored */
+void cs_symupper_gaxpy(const cs* A, const double* x, double* y);
+
+/**
+ * conjugate gradient with block Jacobi preconditioning on a symmetric matrix allocated by
+ * cs_blockpattern_upper(). Minv holds the inverse of each bs x bs diagonal block in column
+ * major order, x is the initial guess on input and the solution on output.
+ * Iterates until |b-A*x| <= tolerance*|b| or maxIterations is reached, work has to hold 4*n doubles.
+ * @return number of iterations, -1 if A is not positive definite
+ */
+int cs_blockpcg(const cs* A, const double* b, double* x, const double* Minv, int bs,
+    double tolerance, int maxIterations, double* work, double* residual=0);
+
+/**
+ * mixed precision solve of A*y=b by the single precision factor N: the factorization is computed in
+ * single precision and the solution refined to double precision by conjugate gradient on A, which uses
+ * the factor as preconditioner. Hence, each iteration costs a solve by the factor and a product with A,
+ * like a step of plain iterative refinement, but it converges also if the factor is only a rough
+ * approximation of A due to a large condition number.
+ * Iterates until |b-A*y| <= tolerance*|b| or maxIterations is reached.
+ * x has to hold n doubles, xwork nb*bs*bs doubles, work 2*nb ints and rwork 4*n doubles.
+ * On success b receives the solution, otherwise b is not touched.
+ * @return number of iterations, -1 if the factorization failed or the refinement did not converge
+ */
+int cs_blockcholsolrefine(const cs *A, double *b, const css* S, csbn* N, double* x, double* xwork, int* work,
+    int maxIterations, double tolerance, double* rwork, ThreadPool* pool=0);
+
 } // end namespace
 
 #endif
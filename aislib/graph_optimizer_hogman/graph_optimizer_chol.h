@@ -18,21 +18,26 @@
 #define _GRAPH_OPTIMIZER_CHOL_H_
 
 #include <map>
+#include <list>
+#include <deque>
+#include <pthread.h>
 #include <graph_optimizer/graph_optimizer.h>
 #include <math/transformation.h>
+#include "symbolic_cache.h"
+#include "incremental_cholesky.h"
+#include <stuff/thread_pool.h>
 
 #define LEVENBERG_MARQUARDT
 
 // forward declaration
 struct cs_symbolic;
 typedef struct cs_symbolic css;
+struct cs_sparse;
+typedef struct cs_sparse cs;
 
 namespace AISNavigation {
 
-  class SparseMatrixEntry;
-
-  template <typename PG>
-  struct ActivePathUniformCostFunction;
+  struct cs_block_numeric;
 
   template <typename PG>
   struct HCholOptimizer;
@@ -51,7 +56,6 @@ namespace AISNavigation {
       {}
     };
 
-    friend struct ActivePathUniformCostFunction<PG>;
     CholOptimizer();
     virtual ~CholOptimizer();
     virtual bool initialize(int rootNode=-1);
@@ -61,9 +65,317 @@ namespace AISNavigation {
     virtual typename PG::Edge* addEdge(typename PG::Vertex* from, typename PG::Vertex* to,
         const typename PG::TransformationType& mean,
         const typename PG::InformationType& information);
+    virtual bool removeEdge(Graph::Edge* e);
+    virtual bool removeVertex(Graph::Vertex* v);
+    virtual typename PG::Vertex* addVertex(const int& k);
+    virtual typename PG::Vertex* addVertex(int id, const typename PG::TransformationType& pose, const typename PG::InformationType& information);
+    virtual void refineEdge(typename PG::Edge* e, const typename PG::TransformationType& mean, const typename PG::InformationType& information);
 
     bool& useManifold() {return  _useRelativeError;}
 
+    /**
+     * termination of optimizeSubset() before the given number of iterations: the iterations stop
+     * once the relative change of chi2 is below chi2Tolerance(), the largest entry of the last
+     * update is below updateTolerance() or more than timeBudget() seconds have been spent.
+     * With slowConvergenceRatio() they stop with TERMINATE_SLOW if the second step gains more than
+     * this fraction of the first one. A value of 0 disables the criterion. If a covariance is requested, it is computed in the
+     * iteration which terminates.
+     */
+    double& chi2Tolerance() {return _chi2Tolerance;}
+    double& updateTolerance() {return _updateTolerance;}
+    double& timeBudget() {return _timeBudget;}
+    double& slowConvergenceRatio() {return _slowConvergenceRatio;}
+    /**
+     * Levenberg-Marquardt damping of the steps of optimizeSubset(), a step which increases chi2 is
+     * rejected and the damping increased. The optimization stops with TERMINATE_DAMPING after
+     * maxRejections() consecutive rejected steps.
+     */
+    bool& useLevenbergMarquardt() {return _useLevenbergMarquardt;}
+    int& maxRejections() {return _maxRejections;}
+    enum Termination {TERMINATE_ITERATIONS=0, TERMINATE_CHI2=1, TERMINATE_UPDATE=2, TERMINATE_TIME=3, TERMINATE_DAMPING=4, TERMINATE_SLOW=5};
+    //! the reason why the last optimizeSubset() stopped
+    Termination termination() const {return _context.termination;}
+    //! chi2 of the subset at the last linearization, the edges leaving the subset are weighted by lambda
+    double subsetChi2() const {return _context.linearChi2;}
+
+    /**
+     * fill reducing orderings of the system, the first three correspond to CS_ORDER_*.
+     * ORDER_APPEND keeps the elimination order of the previous analysis and eliminates
+     * new vertices last, the first analysis uses AMD. An AMD ordering replaces the appended one
+     * once its factor has more than appendFillRatio() times the fill of the last AMD ordering.
+     */
+    enum Ordering {ORDER_NATURAL=0, ORDER_AMD=1, ORDER_NESTED_DISSECTION=2, ORDER_APPEND=3, ORDER_COUNT=4};
+    //! statistics of the symbolic analyses carried out with one ordering
+    struct OrderingStatistics {
+      OrderingStatistics() : analyses(0), time(0.), nnzL(0.), flops(0.) {}
+      int analyses;  ///< number of analyses, hits of the symbolic cache are not counted
+      double time;   ///< cumulated time of ordering and analysis
+      double nnzL;   ///< entries of the factor of the last analysis
+      double flops;  ///< estimated flops of the factorization of the last analysis
+    };
+    int& ordering() {return _ordering;}
+    double& appendFillRatio() {return _appendFillRatio;}
+    const OrderingStatistics& orderingStatistics(int ordering) const {return _orderingStatistics[ordering];}
+
+    /**
+     * incremental mode for online operation: the factor is kept between calls of optimize(..., true),
+     * new vertices and edges are added to it by updates. The system is relinearized and
+     * factorized from scratch if the step w.r.t. the linearization point exceeds relinearizeThreshold()
+     * or the number of blocks in the factor grew by more than refactorFillRatio().
+     */
+    bool& incremental() {return _incremental;}
+    double& relinearizeThreshold() {return _relinearizeThreshold;}
+    double& refactorFillRatio() {return _refactorFillRatio;}
+    //! changes of the solution below this value are not propagated in the back substitution
+    double& incrementalSolveTolerance() {return _incrementalSolveTolerance;}
+
+    /**
+     * affected region updates for online operation: optimize(..., true) solves only for the vertices
+     * within regionDepth() edges of the vertices whose edges were added, refined or removed since the
+     * last optimization, the vertices around the region are held fixed. If the largest motion on the
+     * border of the region exceeds regionLeakThreshold() times the largest motion within it, the
+     * correction leaks out of the region and the whole graph is optimized. Regions larger than
+     * regionMaxFraction() of the graph are optimized globally right away. The incremental mode takes
+     * precedence.
+     */
+    bool& regionalUpdates() {return _regionalUpdates;}
+    int& regionDepth() {return _regionDepth;}
+    double& regionLeakThreshold() {return _regionLeakThreshold;}
+    double& regionMaxFraction() {return _regionMaxFraction;}
+    //! vertices of the region of the last online update, -1 if the whole graph was optimized
+    int lastRegionSize() const {return _lastRegionSize;}
+
+    /**
+     * fixed-lag smoothing: optimize() solves only for the last fixedLag() vertices added while the
+     * mode is on, 0 disables it. Older vertices are marginalized, the linearization of their edges
+     * is reduced by the schur complement to a dense prior on the remaining vertices they are connected
+     * to, the vertices and the edges stay in the graph at their last estimate. Edges added later to a
+     * marginalized vertex treat it as fixed. The priors take part in every solve of the optimizer.
+     * The mode takes precedence over the incremental and the regional updates.
+     */
+    int& fixedLag() {return _fixedLag;}
+    //! vertices marginalized so far
+    int marginalizedVertices() const {return _marginalizedIds.size();}
+
+    /**
+     * sparsification for lifelong operation: removes v and keeps the information of its edges on its
+     * neighbors. The edges of v are linearized at the current estimate and v is eliminated by the schur
+     * complement. The dense information left on the neighbors is approximated by the Chow-Liu tree of
+     * their pairwise conditional informations, each edge of the tree becomes an edge at the current
+     * relative pose of its vertices. Returns false and leaves the graph unchanged for the root, the
+     * fixed vertices, the vertices of the fixed-lag priors or if the elimination fails.
+     */
+    bool sparsifyVertex(typename PG::Vertex* v);
+    //! a vertex removed by sparsify(), its pose was the one of the vertex into times offset
+    struct MergedVertex {
+      int id;
+      int into;
+      typename PG::TransformationType offset;
+    };
+    /**
+     * removes by sparsifyVertex() the newer vertex of each edge whose vertices are closer than
+     * maxTranslation and maxRotation, the memory stays bounded while the robot revisits known places.
+     * Meant to be called on an optimized graph. Returns the number of removed vertices.
+     */
+    virtual int sparsify(double maxTranslation, double maxRotation, std::vector<MergedVertex>* merged=0);
+
+    //! number of threads used for the linearization and the factorization, the result does not depend on it since the graph is visited in id order
+    int& numThreads() {return _numThreads;}
+    //! cache of the symbolic factorizations of the subsets
+    SymbolicCholeskyCache& symbolicCache() {return _symbolicCache;}
+
+    /**
+     * systems up to this dimension are solved by a dense block cholesky decomposition, which avoids
+     * the symbolic analysis and the sparse data structures for the small subsets of the hierarchy.
+     * 0 disables the dense solver.
+     */
+    int& denseDimension() {return _denseDimension;}
+
+    /**
+     * solve the linear systems by conjugate gradient with block Jacobi preconditioning instead of
+     * the sparse cholesky. The memory grows linearly with the number of edges since the system is
+     * never factorized. The incremental mode always uses the cholesky factor.
+     */
+    bool& usePCG() {return _usePCG;}
+    //! the iterations stop once the residual relative to the right hand side is below this value
+    double& pcgTolerance() {return _pcgTolerance;}
+    int& pcgMaxIterations() {return _pcgMaxIterations;}
+    //! number of iterations of the last pcg solve
+    int pcgIterations() const {return _context.pcgIterations;}
+
+    /**
+     * lazy relinearization: the jacobians of an edge are kept until one of its vertices moved by more
+     * than lazyTranslationThreshold() or lazyRotationThreshold() from the pose at which the vertex was
+     * linearized. The residuals are evaluated at the current estimate in each iteration, hence the
+     * thresholds only bound the error of the jacobians. The linearizations are kept in the context
+     * between the calls of optimizeSubset() and dropped if an edge is refined or removed, they need
+     * five blocks of dim x dim doubles per edge. Only the manifold error, see useManifold(), is
+     * linearized lazily.
+     */
+    bool& lazyRelinearization() {return _lazyRelinearization;}
+    double& lazyTranslationThreshold() {return _lazyTranslationThreshold;}
+    double& lazyRotationThreshold() {return _lazyRotationThreshold;}
+    //! edges linearized from scratch by the last iteration of optimizeSubset()
+    int relinearizedEdges() const {return _context.relinearizedEdges;}
+
+    /**
+     * factorize the sparse systems in single precision, which halves the size of the factor and the
+     * memory traffic of the factorization and the solves. The double precision accuracy is recovered
+     * by refinement against the residual computed in double precision, see cs_blockcholsolrefine().
+     * If the factorization fails or the refinement does not converge, the system is refactorized in
+     * double precision. Covariance queries and the incremental mode always use a double precision factor.
+     */
+    bool& mixedPrecision() {return _mixedPrecision;}
+    int& refinementIterations() {return _refinementIterations;}
+    //! the refinement stops once the residual relative to the right hand side is below this value
+    double& refinementTolerance() {return _refinementTolerance;}
+    //! refinement iterations of the last mixed precision solve, -1 if it fell back to double precision
+    int refinementSteps() const {return _context.refinementSteps;}
+
+    /**
+     * covariance queries at the current estimate. All queries until the next optimization or change
+     * of the graph share one factorization of the whole system with the root held fixed. Blocks on
+     * the pattern of the factor are taken from its sparse inverse, each other block costs dim solves
+     * which are shared by all the blocks of the same second vertex. The answers are cached.
+     * The covariances refer to the parameters of the pose update, the root and the fixed vertices
+     * have zero covariance.
+     * @return false if one of the vertices does not exist or the system is not positive definite
+     */
+    bool marginalCovariances(const std::vector<int>& ids, std::vector<typename PG::InformationType>& covariances);
+    //! the blocks of the joint covariance of two vertices
+    struct JointCovariance {
+      typename PG::InformationType ii, ij, jj;
+    };
+    bool jointCovariances(const std::vector< std::pair<int,int> >& pairs, std::vector<JointCovariance>& covariances);
+    //! the block cov(first, second) for each pair
+    bool covarianceBlocks(const std::vector< std::pair<int,int> >& pairs, std::vector<typename PG::InformationType>& blocks);
+    //! forces the next query to refactorize, needed if the vertices were moved from outside the optimizer
+    void invalidateCovariances();
+
+    //! the contribution of one edge to the linear system
+    struct LinearizedConstraint {
+      int i, j;
+      typename PG::InformationType Aii, Ajj, Aij;
+      typename PG::TransformationVectorType bi, bj;
+      double chi2;
+    };
+    //! pose of a vertex at which its edges were linearized, the stamp counts the relinearizations
+    struct LinearizationPoint {
+      LinearizationPoint() : stamp(0), call(-1) {}
+      typename PG::TransformationType pose;
+      int stamp;
+      int call; ///< last call of optimizeSubset() which touched the vertex
+    };
+    /**
+     * quadratic chi2 of the vertices left by a marginalization: chi2+d'*H*d-2*b'*d, d being the
+     * PoseDifference of the vertices from the linearization point. H is dense and row major.
+     */
+    struct MarginalPrior {
+      std::vector<int> ids;
+      std::vector<typename PG::TransformationType> poses; ///< linearization point
+      std::vector<double> H;
+      std::vector<double> b;
+      double chi2;
+    };
+    //! prior of an optimizeSubset() call, the index and the block offsets are those of its vertices in the system
+    struct ActivePrior {
+      const MarginalPrior* prior;
+      std::vector<typename PG::Vertex*> vertices;
+      std::vector<int> index;
+      std::vector<int> blockOffset; ///< offset of the block (a,b) at a*n+b, a<b
+    };
+    //! jacobians of an edge weighted by the information matrix, valid as long as the stamps of the vertices match
+    struct EdgeLinearization {
+      EdgeLinearization() : fromStamp(-1), toStamp(-1) {}
+      int fromStamp, toStamp;
+      typename PG::InformationType AtOmega, BtOmega; ///< A^T*omega, B^T*omega
+      typename PG::InformationType Aii, Ajj, Aij;    ///< A^T*omega*A, B^T*omega*B, A^T*omega*B
+    };
+
+    /**
+     * state of one optimizeSubset() call: the index mapping of the subset, the active edges, the linear
+     * system, the factor and the scratch memory. Nothing of it is stored in the vertices or the edges,
+     * hence calls with distinct contexts on subsets which do not share a vertex may run concurrently.
+     * The optimizer keeps one context for optimizeSubset() without a context, the incremental mode and
+     * the covariance queries. The memory is kept between the calls to avoid re-allocations.
+     */
+    struct SolverContext {
+      SolverContext();
+      ~SolverContext();
+      //! block of v in the system, -1 for the root, the fixed vertices and the vertices outside the subset
+      int index(const Graph::Vertex* v) const;
+
+      ThreadPool* pool; ///< parallel linearization and factorization, 0 runs them serially
+      Termination termination; ///< the reason why the last optimizeSubset() stopped
+      double linearChi2; ///< chi2 accumulated by buildLinearSystem()
+      int pcgIterations; ///< iterations of the last pcg solve
+      int refinementSteps; ///< refinement iterations of the last mixed precision solve
+      int relinearizedEdges; ///< edges linearized from scratch by the last buildLinearSystem()
+
+      std::vector<typename PG::Vertex*> ivMap; ///< vertex of each block
+      std::vector< std::pair<const Graph::Vertex*, int> > vertexIndex; ///< block of each vertex, sorted by the vertex
+      std::set<typename PG::Edge*, Graph::EdgeIDCompare> activeEdges;
+      std::vector<typename PG::Edge*> activeEdgeVector;
+      std::vector< std::pair<int, int> > edgeIndex; ///< blocks of the two vertices of each active edge
+      std::vector<typename PG::TransformationType> storedTransformations; ///< poses of ivMap before a damped step
+      std::vector<ActivePrior> activePriors; ///< priors with at least one vertex in the system
+      std::vector<double> priorWorkspace;
+
+      cs* csA; ///< upper triangle of the system matrix, its pattern is built once per subset
+      std::vector<int> diagBlockOffset; ///< offset of the diagonal block of each vertex within its block column
+      std::vector<int> edgeBlockOffset; ///< offset of the upper triangular block of each active edge
+      double* sparseB;
+      int sparseDim;
+      int sparseDimMax;
+      int sparseNz;
+      std::vector<double> dampedRhs; ///< right hand side of the damped system
+      std::vector<LinearizedConstraint> linearizedConstraints;
+
+      // lazy relinearization, the maps are kept between the calls
+      std::map<const Graph::Vertex*, LinearizationPoint> linearizationPoints;
+      std::map<const Graph::Edge*, EdgeLinearization> edgeLinearizations;
+      int linearizationRevision; ///< revision of the edges of the optimizer the maps refer to
+      int linearizationCall;
+      std::vector< std::pair<const typename PG::Vertex*, LinearizationPoint*> > lazyVertices; ///< vertices of the active edges
+      std::vector<EdgeLinearization*> edgeCache; ///< linearization of each active edge, empty if not lazy
+      std::vector< std::pair<LinearizationPoint*, LinearizationPoint*> > edgePoints; ///< linearization points of the two vertices
+      std::vector<char> relinearize; ///< active edges which have to be linearized from scratch
+
+      css* symbolicCholesky; ///< symbolic factorization of the current subset, held from the symbolic cache
+      std::vector<int> structureSignature; ///< block pattern of the current subset
+      size_t structureHash;
+      std::vector<int> appendPermutation; ///< ORDER_APPEND permutation of the current subset
+      cs_block_numeric* numericCholesky; ///< storage of L and the gather map, refilled for each factorization
+      std::vector<double> sparseInverse; ///< blocks of the inverse on the pattern of L
+      // workspace for cholesky, to avoid re-allocation within csparse
+      int csWorkspaceSize;
+      double* csWorkspace;
+      int* csIntWorkspace;
+      // workspace for cholesky inv solve, to avoid re-allocation within csparse
+      int csInvWorkspaceSize;
+      double* csInvWorkB;
+      double* csInvWorkTemp;
+
+      std::vector<double> denseCholesky; ///< lower block triangle of the dense factor
+      std::vector<char> denseNonZero; ///< non zero blocks of denseCholesky
+      std::vector<double> denseWorkspace;
+      std::vector<double> pcgPreconditioner; ///< inverse of the diagonal blocks
+      std::vector<double> pcgWorkspace;
+
+    private:
+      SolverContext(const SolverContext&);
+      SolverContext& operator=(const SolverContext&);
+    };
+
+    /**
+     * optimizeSubset() in the given context. Concurrent calls have to use distinct contexts and
+     * subsets which do not share a vertex, neither the root nor the other node. They may share the
+     * neighbors which are not part of any subset, those are only read. The verbose output and
+     * the visualization are restricted to the context of the optimizer.
+     */
+    int optimizeSubset(SolverContext& context, typename PG::Vertex* rootVertex, Graph::VertexSet& vset, int iterations, double lambda,
+        bool initFromObservations, int otherNode=-1, typename PG::InformationType* otherCovariance=0);
+
     using typename GraphOptimizer<PG>::verbose;
     using typename GraphOptimizer<PG>::vertex;
     using typename GraphOptimizer<PG>::vertices;
@@ -73,50 +385,168 @@ namespace AISNavigation {
     using typename GraphOptimizer<PG>::_guessOnEdges;
     using typename GraphOptimizer<PG>::_visualizeToStdout;
 
-    bool buildIndexMapping(typename PG::Vertex* rootVertex, Graph::VertexSet& vset);
-    void clearIndexMapping();
-    virtual void computeActiveEdges(typename PG::Vertex* rootVertex, Graph::VertexSet& vset);
-    int linearizeConstraint(const typename PG::Edge* e, double lambda);
+    bool buildIndexMapping(SolverContext& ctx, typename PG::Vertex* rootVertex, Graph::VertexSet& vset);
+    void clearIndexMapping(SolverContext& ctx);
+    virtual void computeActiveEdges(SolverContext& ctx, typename PG::Vertex* rootVertex, Graph::VertexSet& vset);
+    void buildSparseStructure(SolverContext& ctx);
+    //! upper triangular block pattern of the active edges and priors
+    void computeBlockRows(const SolverContext& ctx, std::vector< std::vector<int> >& blockRows) const;
+    //! allocates the system of the pattern and computes the offsets of the blocks of the edges and priors
+    void allocateSparseSystem(SolverContext& ctx, const std::vector< std::vector<int> >& blockRows);
+    //! resolves the priors of the vertices of the system
+    void computeActivePriors(SolverContext& ctx);
+    void accumulatePriors(SolverContext& ctx);
+    struct LinearizeTask;
+    friend struct LinearizeTask;
+    //! i and j are the blocks of the two vertices, -1 if the vertex is not part of the system
+    void linearizeConstraint(const typename PG::Edge* e, int i, int j, double lambda, LinearizedConstraint& lc) const;
+    //! linearization of the active edge k, lazily if the context holds the linearizations
+    void linearizeEdge(const SolverContext& ctx, int k, double lambda, LinearizedConstraint& lc) const;
+    void linearizeConstraintLazy(const typename PG::Edge* e, int i, int j, double lambda, EdgeLinearization& el, bool relinearize,
+        LinearizedConstraint& lc) const;
+    //! resolves the linearizations of the active edges in the maps of the context
+    void prepareLazyLinearization(SolverContext& ctx);
+    //! moves the linearization points of the vertices which moved too far and flags the edges to relinearize
+    void updateLinearizationPoints(SolverContext& ctx);
+    int accumulateConstraint(SolverContext& ctx, const LinearizedConstraint& lc, int offset);
+    ThreadPool* threadPool();
+    //! the context of the optimizer, its pool is the one of the optimizer
+    SolverContext& defaultContext();
 
-    void buildLinearSystem(typename PG::Vertex* rootVertex, double lambda);
-    void solveAndUpdate(double** block=0, int r1=-1, int c1=-1, int r2=-1, int c2=-1);
+    void buildLinearSystem(SolverContext& ctx, typename PG::Vertex* rootVertex, double lambda);
+    void prepareCholesky(SolverContext& ctx, bool singlePrecision=false);
+    //! returns the symbolic factorization of ctx to the cache
+    void releaseCholesky(SolverContext& ctx);
+    css* symbolicAnalysis(SolverContext& ctx);
+    void computeAppendOrdering(SolverContext& ctx);
+    void solveAndUpdate(SolverContext& ctx, double** block=0, int r1=-1, int c1=-1, int r2=-1, int c2=-1);
+    bool solvePCG(SolverContext& ctx, double** block, int r1, int c1, int r2, int c2);
+    bool solveDense(SolverContext& ctx, double** block, int r1, int c1, int r2, int c2);
 
-    void storeVertices();
-    void restoreVertices();
+    int optimizeIncremental(typename PG::Vertex* rootVertex, Graph::VertexSet& vset, int iterations);
+    int relinearizeIncremental(typename PG::Vertex* rootVertex, Graph::VertexSet& vset, int iterations, bool full);
+    double applyIncrementalSolution();
+
+    bool prepareCovariances();
+
+    void storeVertices(SolverContext& ctx);
+    void restoreVertices(SolverContext& ctx);
 
     double globalFrameChi2() const;
 
+    //! records the vertices of e for the next regional update
+    void markAffected(const Graph::Edge* e);
+    //! optimizes the region around the affected vertices, false if the whole graph has to be optimized
+    bool optimizeAffectedRegion(typename PG::Vertex* rootVertex, int iterations);
+    //! optimizes the window of the fixed-lag mode and marginalizes the vertices which left it
+    void optimizeFixedLag(typename PG::Vertex* rootVertex, int iterations);
+    //! replaces the vertices by a prior on their neighbors, returns false if it failed
+    bool marginalize(typename PG::Vertex* rootVertex, const std::vector<typename PG::Vertex*>& vertices);
+    //! conditional informations of two neighbors of the vertex removed by sparsifyVertex()
+    struct NeighborPair {
+      double weight; ///< log det of the two informations, the tree maximizes the sum of the weights
+      int a, b;
+      typename PG::InformationType Jaa, Jbb; ///< information on a given b and on b given a
+      bool operator<(const NeighborPair& p) const {return weight>p.weight;}
+    };
+    struct SparsifiedEdge {
+      typename PG::Vertex* from;
+      typename PG::Vertex* to;
+      typename PG::TransformationType mean;
+      typename PG::InformationType information;
+    };
+    //! length of the translation and largest rotation angle of the motion from a to b
+    static void motion(const typename PG::TransformationType& a, const typename PG::TransformationType& b,
+        double& translation, double& rotation);
+
     int _rootNode;
-    std::vector<typename PG::Vertex*> _ivMap;
-    std::set<typename PG::Edge*> _activeEdges;
+    SolverContext _context;
+    pthread_mutex_t _sharedMutex; ///< guards the state shared by the contexts: symbolic cache, orderings and covariances
 
     // noddesequence should not contain duplicates
     void transformSubset(typename PG::Vertex* rootVertex, Graph::VertexSet& vset, const typename PG::TransformationType& newRootPose);
-    void initializeActiveSubsetWithObservations(typename PG::Vertex* rootVertex, double maxDistance=std::numeric_limits<double>::max()/2);
+    void initializeActiveSubsetWithObservations(SolverContext& ctx, typename PG::Vertex* rootVertex,
+        double maxDistance=std::numeric_limits<double>::max()/2);
 
     int _addDuplicateEdgeIterations;
 
-    // temp used for cholesky
-    SparseMatrixEntry * _sparseMatrix;
-    SparseMatrixEntry** _sparseMatrixPtr; ///< used to avoid multiple sorting
-    double* _sparseB;
-    int _nBlocks;
-    int _sparseDim;
-    int _sparseDimMax;
-    int _sparseNz;
-    int _sparseNzMax;
-
-    css* _symbolicCholesky;
-    // workspace for cholesky, to avoid re-allocation within csparse
-    int _csWorkspaceSize;
-    double* _csWorkspace;
-    int* _csIntWorkspace;
-    // workspace for cholesky inv solve, to avoid re-allocation within csparse
-    int _csInvWorkspaceSize;
-    double* _csInvWorkB;
-    double* _csInvWorkTemp;
+    SymbolicCholeskyCache _symbolicCache;
+    int _ordering;
+    OrderingStatistics _orderingStatistics[ORDER_COUNT];
+    std::vector<int> _previousOrder; ///< ids of the vertices in the elimination order of the last analysis
+    double _appendFillRatio;
+    double _appendReferenceFill; ///< entries of the factor per entry of the system of the last AMD ordering
     bool _useRelativeError;
 
+    double _chi2Tolerance;
+    double _updateTolerance;
+    double _timeBudget;
+    double _slowConvergenceRatio;
+    bool _useLevenbergMarquardt;
+    int _maxRejections;
+
+    int _numThreads;
+    ThreadPool* _threadPool;
+    int _threadPoolSize;
+    int _linearizeGrainSize; ///< number of edges linearized by one task
+
+    int _denseDimension;
+
+    bool _usePCG;
+    double _pcgTolerance;
+    int _pcgMaxIterations;
+
+    bool _mixedPrecision;
+    int _refinementIterations;
+    double _refinementTolerance;
+
+    bool _lazyRelinearization;
+    double _lazyTranslationThreshold;
+    double _lazyRotationThreshold;
+    int _linearizationRevision; ///< incremented if an edge is refined or removed
+
+    // covariance queries
+    bool _covarianceValid;
+    int _covarianceRoot;
+    cs_block_numeric* _covarianceCholesky; ///< factor of the whole system, owned by the optimizer
+    std::vector<int> _covariancePinv; ///< block permutation of the factor, empty for the natural ordering
+    std::vector<int> _covarianceParent; ///< elimination tree of the factor
+    std::map<int, int> _covarianceIndex; ///< block of each vertex id in the unpermuted system
+    std::vector<double> _covarianceSigma; ///< sparse inverse, the columns flagged in _covarianceDone are computed
+    std::vector<char> _covarianceDone;
+    std::vector<double> _covarianceWorkspace;
+    std::vector<int> _covarianceIntWorkspace;
+    std::map<std::pair<int, int>, typename PG::InformationType> _covarianceCache; ///< cov(first, second), first<second
+
+    // incremental mode
+    bool _incremental;
+    bool _incrementalValid;
+    typename PG::Vertex* _incrementalRoot;
+    IncrementalBlockCholesky _incrementalCholesky;
+    std::map<const typename PG::Vertex*, int> _incrementalIndex; ///< position of a vertex in the factor
+    std::vector<typename PG::Vertex*> _incrementalVertices;
+    std::vector<typename PG::TransformationType> _linearizationPoints;
+    std::vector<typename PG::Edge*> _incrementalPendingEdges; ///< edges not yet added to the factor
+    size_t _incrementalRefactorNonZeros;
+    double _relinearizeThreshold;
+    double _refactorFillRatio;
+    double _incrementalSolveTolerance;
+
+    // affected region updates
+    bool _regionalUpdates;
+    int _regionDepth;
+    double _regionLeakThreshold;
+    double _regionMaxFraction;
+    int _lastRegionSize;
+    std::set<int> _affectedVertices; ///< ids of the vertices whose edges changed since the last optimization
+
+    // fixed-lag smoothing
+    int _fixedLag;
+    std::deque<int> _lagWindow; ///< ids of the vertices which have not been marginalized, in the order they were added
+    std::set<int> _marginalizedIds;
+    std::set<const Graph::Edge*> _marginalizedEdges; ///< edges whose information is held by the priors
+    std::list<MarginalPrior> _priors;
+
   };
 
 } // end namespace
@@ -18,6 +18,7 @@
 #include <iomanip>
 #include <algorithm>
 #include <iterator>
+#include <deque>
 #include <sys/time.h>
 #include <stuff/os_specific.h>
 #include <stuff/color_macros.h>
@@ -29,6 +30,7 @@ namespace AISNavigation{
 
   template <typename PG>
   bool CholOptimizer<PG>::initialize(int rootNode){
+    invalidateCovariances();
     if (this->verbose())
       cerr << "# init " << rootNode << endl;
     if (this->vertex(rootNode)){
@@ -36,64 +38,734 @@ namespace AISNavigation{
       return true;
     }
     _rootNode=-1;
-    _ivMap.clear();
-    _activeEdges.clear();
+    _context.ivMap.clear();
+    _context.activeEdges.clear();
     return false;
   }
   
   template <typename PG>
   int CholOptimizer<PG>::optimize(int iterations, bool online){
-    Graph::VertexSet vset;
-    for (Graph::VertexIDMap::const_iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
-      vset.insert(it->second);
-    }
-    
     typename PG::Vertex* root=dynamic_cast<typename PG::Vertex*>(this->vertex(_rootNode));
     if (! root)
       root=_MY_CAST_<typename PG::Vertex*>(this->vertices().begin()->second);
     if (this->verbose())
       cerr << "# root id " << root->id() << endl;
+    if (_fixedLag>0){
+      optimizeFixedLag(root, iterations);
+      _lastRegionSize=-1;
+      _affectedVertices.clear();
+      return iterations;
+    }
+    if (online && ! _incremental && _regionalUpdates && optimizeAffectedRegion(root, iterations)){
+      _affectedVertices.clear();
+      return iterations;
+    }
+    _lastRegionSize=-1;
+    _affectedVertices.clear();
+
+    Graph::VertexSet vset;
+    for (Graph::VertexIDMap::const_iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
+      vset.insert(it->second);
+    }
+    if (online && _incremental)
+      return optimizeIncremental(root, vset, iterations);
     bool initFromObservations = _guessOnEdges;
     optimizeSubset(root, vset, iterations, 0., initFromObservations);
     return iterations;
   }
 
+  template <typename PG>
+  void CholOptimizer<PG>::markAffected(const Graph::Edge* e){
+    if (! _regionalUpdates || ! e)
+      return;
+    _affectedVertices.insert(e->from()->id());
+    _affectedVertices.insert(e->to()->id());
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::motion(const typename PG::TransformationType& a, const typename PG::TransformationType& b,
+      double& translation, double& rotation){
+    // the translation comes first in the vector of a transformation
+    const int tdim = PG::TransformationType::TranslationType::TemplateSize;
+    const int dim = PG::TransformationVectorType::TemplateSize;
+    typename PG::TransformationVectorType d=(a.inverse()*b).toVector();
+    double t=0.;
+    for (int c=0; c<tdim; c++)
+      t+=d[c]*d[c];
+    translation=sqrt(t);
+    rotation=0.;
+    for (int c=tdim; c<dim; c++)
+      rotation=std::max(rotation, fabs(d[c]));
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::optimizeAffectedRegion(typename PG::Vertex* rootVertex, int iterations){
+    _lastRegionSize=0;
+    if (_affectedVertices.empty())
+      return true;
+
+    // breadth first search up to regionDepth() edges from the affected vertices
+    std::map<Graph::Vertex*, int, Graph::VertexIDCompare> depth;
+    std::deque<Graph::Vertex*> queue;
+    for (std::set<int>::const_iterator it=_affectedVertices.begin(); it!=_affectedVertices.end(); it++){
+      Graph::Vertex* v=this->vertex(*it);
+      if (v && depth.insert(std::make_pair(v, 0)).second)
+        queue.push_back(v);
+    }
+    Graph::Vertex* outside=0;
+    while (! queue.empty()){
+      Graph::Vertex* v=queue.front();
+      queue.pop_front();
+      int d=depth[v];
+      for (Graph::EdgeSet::const_iterator it=v->edges().begin(); it!=v->edges().end(); it++){
+        Graph::Vertex* w=(*it)->from()==v ? (*it)->to() : (*it)->from();
+        if (depth.find(w)!=depth.end())
+          continue;
+        if (d<_regionDepth){
+          depth[w]=d+1;
+          queue.push_back(w);
+        } else if (! outside)
+          outside=w;
+      }
+    }
+    if (depth.size() > _regionMaxFraction*this->vertices().size())
+      return false;
+
+    // the gauge is fixed by the root or, if it is not part of the region, by the vertices around it
+    typename PG::Vertex* root=rootVertex;
+    if (depth.find(root)==depth.end()){
+      if (! outside)
+        return false;
+      root=_MY_CAST_<typename PG::Vertex*>(outside);
+    }
+    Graph::VertexSet vset;
+    std::vector<typename PG::TransformationType> poses;
+    poses.reserve(depth.size());
+    for (std::map<Graph::Vertex*, int, Graph::VertexIDCompare>::const_iterator it=depth.begin(); it!=depth.end(); it++){
+      vset.insert(it->first);
+      poses.push_back(_MY_CAST_<typename PG::Vertex*>(it->first)->transformation);
+    }
+
+    optimizeSubset(root, vset, iterations, 1., false);
+
+    // the correction leaks out of the region if it did not decay towards the border
+    double regionMotion=0., borderMotion=0.;
+    size_t k=0;
+    for (std::map<Graph::Vertex*, int, Graph::VertexIDCompare>::const_iterator it=depth.begin(); it!=depth.end(); it++, k++){
+      double t, r;
+      motion(poses[k], _MY_CAST_<typename PG::Vertex*>(it->first)->transformation, t, r);
+      double m=std::max(t, r);
+      regionMotion=std::max(regionMotion, m);
+      if (it->second==_regionDepth)
+        borderMotion=std::max(borderMotion, m);
+    }
+    double leak = regionMotion>0. ? borderMotion/regionMotion : 0.;
+    if (this->verbose())
+      cerr << "# region vertices= " << vset.size() << " motion= " << regionMotion << " leak= " << leak << endl;
+    if (leak > _regionLeakThreshold)
+      return false;
+    _lastRegionSize=vset.size();
+    return true;
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::optimizeFixedLag(typename PG::Vertex* rootVertex, int iterations){
+    Graph::VertexSet vset;
+    for (std::deque<int>::const_iterator it=_lagWindow.begin(); it!=_lagWindow.end(); it++)
+      vset.insert(this->vertex(*it));
+    // the new vertices have been initialized by the edges, the window is not reinitialized
+    optimizeSubset(rootVertex, vset, iterations, 1., false);
+
+    if ((int)_lagWindow.size()<=_fixedLag)
+      return;
+    std::vector<typename PG::Vertex*> old;
+    while ((int)_lagWindow.size()>_fixedLag){
+      old.push_back(_MY_CAST_<typename PG::Vertex*>(this->vertex(_lagWindow.front())));
+      _lagWindow.pop_front();
+    }
+    if (! marginalize(rootVertex, old) && this->verbose())
+      cerr << "# marginalization failed, " << old.size() << " vertices are fixed" << endl;
+    for (size_t k=0; k<old.size(); k++)
+      _marginalizedIds.insert(old[k]->id());
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::marginalize(typename PG::Vertex* rootVertex, const std::vector<typename PG::Vertex*>& vertices){
+    int dim = PG::TransformationVectorType::TemplateSize;
+    std::set<const Graph::Vertex*> mset(vertices.begin(), vertices.end());
+
+    // the marginalized vertices come first in the system, followed by the vertices they are
+    // connected to by their edges and priors. The root and the fixed vertices remain constant.
+    SolverContext ctx;
+    for (size_t k=0; k<vertices.size(); k++)
+      if (vertices[k]!=rootVertex && ! vertices[k]->fixed())
+        ctx.ivMap.push_back(vertices[k]);
+    int nm=ctx.ivMap.size();
+    std::set<const Graph::Vertex*> border;
+    std::vector<typename PG::Edge*> edges;
+    for (size_t k=0; k<vertices.size(); k++){
+      const Graph::EdgeSet& vEdges=vertices[k]->edges();
+      for (Graph::EdgeSet::const_iterator it=vEdges.begin(); it!=vEdges.end(); it++){
+        if (_marginalizedEdges.count(*it))
+          continue;
+        Graph::Vertex* w=(*it)->from()==vertices[k] ? (*it)->to() : (*it)->from();
+        if (mset.count(w) && w<vertices[k])
+          continue; // counted from the other vertex
+        edges.push_back(reinterpret_cast<typename PG::Edge*>(*it));
+        typename PG::Vertex* pw=_MY_CAST_<typename PG::Vertex*>(w);
+        if (! mset.count(w) && pw!=rootVertex && ! pw->fixed() && ! _marginalizedIds.count(w->id()) && border.insert(w).second)
+          ctx.ivMap.push_back(pw);
+      }
+    }
+    std::vector<typename std::list<MarginalPrior>::iterator> folded;
+    for (typename std::list<MarginalPrior>::iterator it=_priors.begin(); it!=_priors.end(); it++){
+      bool touched=false;
+      for (size_t a=0; a<it->ids.size() && ! touched; a++)
+        touched=mset.count(this->vertex(it->ids[a]));
+      if (! touched)
+        continue;
+      folded.push_back(it);
+      for (size_t a=0; a<it->ids.size(); a++){
+        typename PG::Vertex* w=_MY_CAST_<typename PG::Vertex*>(this->vertex(it->ids[a]));
+        if (! mset.count(w) && w!=rootVertex && ! w->fixed() && border.insert(w).second)
+          ctx.ivMap.push_back(w);
+      }
+    }
+    int nb=ctx.ivMap.size();
+    for (int i=0; i<nb; i++)
+      ctx.vertexIndex.push_back(std::make_pair(static_cast<const Graph::Vertex*>(ctx.ivMap[i]), i));
+    std::sort(ctx.vertexIndex.begin(), ctx.vertexIndex.end());
+
+    ctx.activeEdgeVector=edges;
+    ctx.edgeIndex.resize(edges.size());
+    for (size_t k=0; k<edges.size(); k++)
+      ctx.edgeIndex[k]=std::make_pair(ctx.index(edges[k]->from()), ctx.index(edges[k]->to()));
+    for (size_t p=0; p<folded.size(); p++){
+      ActivePrior ap;
+      ap.prior=&*folded[p];
+      for (size_t a=0; a<folded[p]->ids.size(); a++){
+        ap.vertices.push_back(_MY_CAST_<typename PG::Vertex*>(this->vertex(folded[p]->ids[a])));
+        ap.index.push_back(ctx.index(ap.vertices.back()));
+      }
+      ctx.activePriors.push_back(ap);
+    }
+    if (nb==0){
+      _marginalizedEdges.insert(edges.begin(), edges.end());
+      for (size_t p=0; p<folded.size(); p++)
+        _priors.erase(folded[p]);
+      return true;
+    }
+
+    // the schur complement of the marginalized vertices in the linearization at the current estimate
+    std::vector< std::vector<int> > blockRows;
+    computeBlockRows(ctx, blockRows);
+    allocateSparseSystem(ctx, blockRows);
+    ctx.pool=0;
+    buildLinearSystem(ctx, rootVertex, 1.);
+    std::vector<double> D(nb*nb*dim*dim);
+    std::vector<char> nz(nb*nb);
+    cs_blockdense_lower(ctx.csA, dim, &D[0], &nz[0]);
+    if (! cs_blockdenseschur(&D[0], nb, nm, dim, &nz[0], ctx.sparseB))
+      return false;
+
+    MarginalPrior prior;
+    int n=nb-nm;
+    int N=n*dim;
+    prior.chi2=ctx.linearChi2;
+    for (int k=0; k<nm*dim; k++)
+      prior.chi2-=ctx.sparseB[k]*ctx.sparseB[k];
+    prior.b.assign(ctx.sparseB+nm*dim, ctx.sparseB+nb*dim);
+    prior.H.assign(N*N, 0.);
+    for (int a=0; a<n; a++){
+      typename PG::Vertex* v=ctx.ivMap[nm+a];
+      prior.ids.push_back(v->id());
+      prior.poses.push_back(v->transformation);
+      for (int b=0; b<=a; b++){
+        int q=(nm+b)*nb+nm+a;
+        if (! nz[q])
+          continue;
+        // the lower block (a,b) is stored column major, of the diagonal blocks only the lower triangle
+        const double* Dab=&D[q*dim*dim];
+        for (int c=0; c<dim; c++)
+          for (int r=(a==b ? c : 0); r<dim; r++)
+            prior.H[(a*dim+r)*N+b*dim+c]=prior.H[(b*dim+c)*N+a*dim+r]=Dab[c*dim+r];
+      }
+    }
+    if (this->verbose())
+      cerr << "# marginalized= " << vertices.size() << " edges= " << edges.size() << " folded priors= " << folded.size()
+           << " prior vertices= " << n << endl;
+    _marginalizedEdges.insert(edges.begin(), edges.end());
+    for (size_t p=0; p<folded.size(); p++)
+      _priors.erase(folded[p]);
+    if (n>0)
+      _priors.push_back(prior);
+    return true;
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::sparsifyVertex(typename PG::Vertex* v){
+    typename PG::Vertex* root=dynamic_cast<typename PG::Vertex*>(this->vertex(_rootNode));
+    if (! root)
+      root=_MY_CAST_<typename PG::Vertex*>(this->vertices().begin()->second);
+    if (v==root || v->fixed() || _marginalizedIds.count(v->id()))
+      return false;
+    for (typename std::list<MarginalPrior>::const_iterator it=_priors.begin(); it!=_priors.end(); it++)
+      if (std::find(it->ids.begin(), it->ids.end(), v->id())!=it->ids.end())
+        return false;
+
+    // the neighbors are all variables, the information of the edges of v is relative and does not depend on the root
+    std::vector<typename PG::Vertex*> neighbors;
+    std::map<const Graph::Vertex*, int> nindex;
+    const Graph::EdgeSet& vEdges=v->edges();
+    for (Graph::EdgeSet::const_iterator it=vEdges.begin(); it!=vEdges.end(); it++){
+      Graph::Vertex* w=(*it)->from()==v ? (*it)->to() : (*it)->from();
+      if (nindex.insert(std::make_pair(w, (int)neighbors.size())).second)
+        neighbors.push_back(_MY_CAST_<typename PG::Vertex*>(w));
+    }
+    int n=neighbors.size();
+    if (n<=1)
+      return this->removeVertex(v);
+
+    typename PG::InformationType zero=PG::InformationType::eye(1.)*0.;
+    typename PG::InformationType Hvv=zero;
+    std::vector<typename PG::InformationType> Hww(n, zero), Hvw(n, zero);
+    for (Graph::EdgeSet::const_iterator it=vEdges.begin(); it!=vEdges.end(); it++){
+      const typename PG::Edge* e=reinterpret_cast<const typename PG::Edge*>(*it);
+      LinearizedConstraint lc;
+      if (e->from()==v){
+        int a=nindex[e->to()];
+        linearizeConstraint(e, 0, a+1, 1., lc);
+        Hvv=Hvv+lc.Aii;
+        Hww[a]=Hww[a]+lc.Ajj;
+        Hvw[a]=Hvw[a]+lc.Aij;
+      } else {
+        int a=nindex[e->from()];
+        linearizeConstraint(e, a+1, 0, 1., lc);
+        Hvv=Hvv+lc.Ajj;
+        Hww[a]=Hww[a]+lc.Aii;
+        Hvw[a]=Hvw[a]+lc.Aij.transpose();
+      }
+    }
+    if (Hvv.det()<=0.)
+      return false;
+    typename PG::InformationType HvvInv=Hvv.inverse();
+    std::vector<typename PG::InformationType> S(n*n, zero);
+    for (int a=0; a<n; a++)
+      for (int b=0; b<n; b++){
+        S[a*n+b]=Hvw[a].transpose()*HvvInv*Hvw[b]*(-1.);
+        if (a==b)
+          S[a*n+b]=S[a*n+b]+Hww[a];
+      }
+
+    // conditional informations of each pair of neighbors, the other neighbors are eliminated first
+    int dim = PG::TransformationVectorType::TemplateSize;
+    int dd=dim*dim;
+    std::vector<NeighborPair> pairs;
+    std::vector<double> D(n*n*dd), x(n*dim);
+    std::vector<char> nz(n*n);
+    std::vector<int> perm(n);
+    for (int a=0; a<n; a++)
+      for (int b=a+1; b<n; b++){
+        int m=0;
+        for (int c=0; c<n; c++)
+          if (c!=a && c!=b)
+            perm[m++]=c;
+        perm[m]=a;
+        perm[m+1]=b;
+        for (int i=0; i<n; i++)
+          for (int j=0; j<=i; j++){
+            const typename PG::InformationType& Sij=S[perm[i]*n+perm[j]];
+            double* Dij=&D[(j*n+i)*dd];
+            for (int c=0; c<dim; c++)
+              for (int r=0; r<dim; r++)
+                Dij[c*dim+r]=Sij[r][c];
+            nz[j*n+i]=1;
+          }
+        std::fill(x.begin(), x.end(), 0.);
+        if (m>0 && ! cs_blockdenseschur(&D[0], n, m, dim, &nz[0], &x[0]))
+          return false;
+        NeighborPair p;
+        p.a=a;
+        p.b=b;
+        const double* Daa=&D[(m*n+m)*dd];
+        const double* Dbb=&D[((m+1)*n+m+1)*dd];
+        for (int c=0; c<dim; c++)
+          for (int r=c; r<dim; r++){
+            p.Jaa[r][c]=p.Jaa[c][r]=Daa[c*dim+r];
+            p.Jbb[r][c]=p.Jbb[c][r]=Dbb[c*dim+r];
+          }
+        double da=p.Jaa.det(), db=p.Jbb.det();
+        if (da<=0. || db<=0.)
+          return false;
+        p.weight=log(da)+log(db);
+        pairs.push_back(p);
+      }
+
+    // maximum spanning tree, rooted at the first neighbor to direct the edges
+    std::sort(pairs.begin(), pairs.end());
+    std::vector<int> component(n);
+    for (int a=0; a<n; a++)
+      component[a]=a;
+    std::vector< std::vector<const NeighborPair*> > tree(n);
+    for (size_t k=0; k<pairs.size(); k++){
+      int ca=component[pairs[k].a], cb=component[pairs[k].b];
+      if (ca==cb)
+        continue;
+      for (int c=0; c<n; c++)
+        if (component[c]==cb)
+          component[c]=ca;
+      tree[pairs[k].a].push_back(&pairs[k]);
+      tree[pairs[k].b].push_back(&pairs[k]);
+    }
+    std::vector<SparsifiedEdge> treeEdges;
+    std::vector<char> visited(n, 0);
+    std::deque<int> queue(1, 0);
+    visited[0]=1;
+    while (! queue.empty()){
+      int a=queue.front();
+      queue.pop_front();
+      for (size_t k=0; k<tree[a].size(); k++){
+        const NeighborPair* p=tree[a][k];
+        int b = p->a==a ? p->b : p->a;
+        if (visited[b])
+          continue;
+        visited[b]=1;
+        queue.push_back(b);
+        SparsifiedEdge te;
+        te.from=neighbors[a];
+        te.to=neighbors[b];
+        te.mean=te.from->transformation.inverse()*te.to->transformation;
+        // the information of the edge on its error which yields the conditional information on b
+        CholEdge aux(te.from, te.to, te.mean, PG::InformationType::eye(1.));
+        typename PG::TransformationVectorType f;
+        typename PG::InformationType A, B;
+        if (_useRelativeError){
+          static ManifoldGradient<PG> gradient;
+          gradient(f,A,B,aux);
+        } else {
+          static Gradient<PG> gradient;
+          gradient(f,A,B,aux);
+        }
+        if (B.det()==0.)
+          return false;
+        typename PG::InformationType Binv=B.inverse();
+        const typename PG::InformationType& Jbb = p->b==b ? p->Jbb : p->Jaa;
+        te.information=Binv.transpose()*Jbb*Binv;
+        te.information=(te.information+te.information.transpose())*.5;
+        treeEdges.push_back(te);
+      }
+    }
+
+    for (size_t k=0; k<treeEdges.size(); k++)
+      this->addEdge(treeEdges[k].from, treeEdges[k].to, treeEdges[k].mean, treeEdges[k].information);
+    return this->removeVertex(v);
+  }
+
+  template <typename PG>
+  int CholOptimizer<PG>::sparsify(double maxTranslation, double maxRotation, std::vector<MergedVertex>* merged){
+    std::vector< std::pair<int, int> > candidates;
+    for (Graph::EdgeSet::const_iterator it=this->edges().begin(); it!=this->edges().end(); it++){
+      typename PG::Vertex* v=_MY_CAST_<typename PG::Vertex*>((*it)->from());
+      typename PG::Vertex* w=_MY_CAST_<typename PG::Vertex*>((*it)->to());
+      if (v->id()<w->id())
+        std::swap(v, w);
+      double t, r;
+      motion(w->transformation, v->transformation, t, r);
+      if (t<=maxTranslation && r<=maxRotation)
+        candidates.push_back(std::make_pair(v->id(), w->id()));
+    }
+    // independent of the addresses of the edges
+    std::sort(candidates.begin(), candidates.end());
+    int removed=0;
+    for (size_t k=0; k<candidates.size(); k++){
+      typename PG::Vertex* v=_MY_CAST_<typename PG::Vertex*>(this->vertex(candidates[k].first));
+      typename PG::Vertex* w=_MY_CAST_<typename PG::Vertex*>(this->vertex(candidates[k].second));
+      if (! v || ! w)
+        continue;
+      MergedVertex mv;
+      mv.id=v->id();
+      mv.into=w->id();
+      mv.offset=w->transformation.inverse()*v->transformation;
+      if (! sparsifyVertex(v))
+        continue;
+      removed++;
+      if (merged)
+        merged->push_back(mv);
+    }
+    if (this->verbose())
+      cerr << "# sparsified= " << removed << " vertices= " << this->vertices().size() << " edges= " << this->edges().size() << endl;
+    return removed;
+  }
+
+  template <typename PG>
+  int CholOptimizer<PG>::optimizeIncremental(typename PG::Vertex* rootVertex, Graph::VertexSet& vset, int iterations){
+    invalidateCovariances();
+    if (! _incrementalValid || rootVertex != _incrementalRoot) {
+      return relinearizeIncremental(rootVertex, vset, iterations, true);
+    }
+    int dim = PG::TransformationVectorType::TemplateSize;
+
+    // new vertices are appended to the factor, new edges are added as rank updates
+    for (size_t k=0; k<_incrementalPendingEdges.size(); k++){
+      typename PG::Edge* e=_incrementalPendingEdges[k];
+      typename PG::Vertex* from=_MY_CAST_<typename PG::Vertex*>(e->from());
+      typename PG::Vertex* to=_MY_CAST_<typename PG::Vertex*>(e->to());
+      typename PG::Vertex* ev[2] = {from, to};
+      int pos[2];
+      for (int q=0; q<2; q++){
+        typename PG::Vertex* v=ev[q];
+        pos[q]=-1;
+        if (v==rootVertex || v->fixed())
+          continue;
+        typename std::map<const typename PG::Vertex*, int>::const_iterator it=_incrementalIndex.find(v);
+        if (it==_incrementalIndex.end()){
+          // initial guess of a new vertex from the one which is already part of the estimate
+          typename PG::Vertex* other=ev[1-q];
+          if (_guessOnEdges && (other==rootVertex || other->fixed() || _incrementalIndex.count(other))){
+            if (v==to)
+              v->transformation=other->transformation*e->mean();
+            else
+              v->transformation=other->transformation*e->mean().inverse();
+          }
+          pos[q]=_incrementalCholesky.appendBlock();
+          _incrementalIndex[v]=pos[q];
+          _incrementalVertices.push_back(v);
+          _linearizationPoints.push_back(v->transformation);
+        } else {
+          pos[q]=it->second;
+        }
+      }
+      if (pos[0]==-1 && pos[1]==-1)
+        continue;
+
+      // linearize at the linearization points of the two vertices
+      for (int q=0; q<2; q++){
+        ev[q]->backup();
+        if (pos[q]!=-1)
+          ev[q]->transformation=_linearizationPoints[pos[q]];
+      }
+      typename PG::TransformationVectorType f;
+      typename PG::InformationType A, B;
+      if (_useRelativeError){
+        static ManifoldGradient<PG> gradient;
+        gradient(f,A,B,*e);
+      } else {
+        static Gradient<PG> gradient;
+        gradient(f,A,B,*e);
+      }
+      for (int q=0; q<2; q++)
+        ev[q]->restore();
+
+      // H += W W', b += W rhs with W = J' L_omega, rhs = L_omega' r
+      typename PG::InformationType omegaSqrt=e->information();
+      for (int c=0; c<dim; c++){
+        for (int k=0; k<c; k++)
+          omegaSqrt[c][c]-=omegaSqrt[c][k]*omegaSqrt[c][k];
+        if (omegaSqrt[c][c]<=0.){
+          return relinearizeIncremental(rootVertex, vset, iterations, true);
+        }
+        omegaSqrt[c][c]=sqrt(omegaSqrt[c][c]);
+        for (int r=c+1; r<dim; r++){
+          for (int k=0; k<c; k++)
+            omegaSqrt[r][c]-=omegaSqrt[r][k]*omegaSqrt[c][k];
+          omegaSqrt[r][c]/=omegaSqrt[c][c];
+          omegaSqrt[c][r]=0.;
+        }
+      }
+      typename PG::TransformationVectorType r=f*(-1.);
+      typename PG::TransformationVectorType rw=omegaSqrt.transpose()*r;
+      std::vector<int> rows;
+      std::vector< std::vector<double> > blocks;
+      const typename PG::InformationType* J[2] = {&A, &B};
+      for (int q=0; q<2; q++){
+        if (pos[q]==-1)
+          continue;
+        typename PG::InformationType W=J[q]->transpose()*omegaSqrt;
+        rows.push_back(pos[q]);
+        blocks.push_back(std::vector<double>(dim*dim));
+        std::vector<double>& block=blocks.back();
+        for (int c=0; c<dim; c++)
+          for (int k=0; k<dim; k++)
+            block[c*dim+k]=W[k][c];
+      }
+      std::vector<double> rhs(&rw[0], &rw[0]+dim);
+      _incrementalCholesky.update(rows, blocks, rhs, dim);
+    }
+    _incrementalPendingEdges.clear();
+
+    if (! _incrementalCholesky.solve(_incrementalSolveTolerance)) {
+      if (this->verbose())
+        cerr << "# incremental factor singular, relinearizing" << endl;
+      return relinearizeIncremental(rootVertex, vset, iterations, true);
+    }
+    double maxStep=applyIncrementalSolution();
+
+    // refactor if the linearization point is too far away or the fill-in grew too much
+    if (maxStep > _relinearizeThreshold ||
+        _incrementalCholesky.nonZeros() > _refactorFillRatio * _incrementalRefactorNonZeros) {
+      if (this->verbose())
+        cerr << "# relinearizing, max step= " << maxStep << " nnz= " << _incrementalCholesky.nonZeros() << endl;
+      return relinearizeIncremental(rootVertex, vset, iterations, false);
+    }
+    return 1;
+  }
+
+  template <typename PG>
+  double CholOptimizer<PG>::applyIncrementalSolution(){
+    // apply the solution to the blocks which changed, the solution is relative to the linearization point
+    int dim = PG::TransformationVectorType::TemplateSize;
+    static PoseUpdate<PG> poseUpdate;
+    double maxStep=0.;
+    for (int k=0; k<_incrementalCholesky.size(); k++){
+      const double* x=_incrementalCholesky.x(k);
+      for (int c=0; c<dim; c++)
+        maxStep=std::max(maxStep, fabs(x[c]));
+      if (! _incrementalCholesky.changed(k))
+        continue;
+      typename PG::TransformationVectorType dx;
+      for (int c=0; c<dim; c++)
+        dx[c]=x[c];
+      typename PG::Vertex* v=_incrementalVertices[k];
+      v->transformation=_linearizationPoints[k];
+      poseUpdate(v->transformation, &dx[0]);
+    }
+    return maxStep;
+  }
+
+  template <typename PG>
+  int CholOptimizer<PG>::relinearizeIncremental(typename PG::Vertex* rootVertex, Graph::VertexSet& vset, int iterations, bool full){
+    // a full relinearization runs the batch optimization first, only the first one initializes from the observations
+    if (full) {
+      bool initFromObservations = _guessOnEdges && rootVertex != _incrementalRoot;
+      optimizeSubset(rootVertex, vset, iterations, 0., initFromObservations);
+    }
+
+    // factorize the system at the current estimate and keep the factor
+    SolverContext& ctx=defaultContext();
+    _incrementalValid=false;
+    _incrementalPendingEdges.clear();
+    _incrementalCholesky.clear();
+    _incrementalIndex.clear();
+    _incrementalVertices.clear();
+    _linearizationPoints.clear();
+    if (vset.size() <= 1 || !buildIndexMapping(ctx, rootVertex,vset)) {
+      return iterations;
+    }
+    computeActiveEdges(ctx, rootVertex,vset);
+    buildSparseStructure(ctx);
+    buildLinearSystem(ctx, rootVertex, 0.);
+    prepareCholesky(ctx);
+    int dim = PG::TransformationVectorType::TemplateSize;
+    int nBlocks = ctx.ivMap.size();
+    if (cs_blockchol_numeric(ctx.csA, ctx.symbolicCholesky, ctx.numericCholesky, ctx.csIntWorkspace, ctx.csWorkspace + ctx.csA->n, ctx.pool)) {
+      // y = L\P b
+      cs_blockipvec(ctx.symbolicCholesky->pinv, ctx.sparseB, ctx.csWorkspace, nBlocks, dim);
+      cs_blocklsolve(ctx.numericCholesky, ctx.csWorkspace, ctx.pool);
+      _incrementalCholesky.assign(ctx.numericCholesky, ctx.csWorkspace);
+      _incrementalVertices.resize(nBlocks);
+      _linearizationPoints.resize(nBlocks);
+      for (int i=0; i<nBlocks; i++){
+        int pos = ctx.symbolicCholesky->pinv ? ctx.symbolicCholesky->pinv[i] : i;
+        typename PG::Vertex* v=ctx.ivMap[i];
+        _incrementalIndex[v]=pos;
+        _incrementalVertices[pos]=v;
+        _linearizationPoints[pos]=v->transformation;
+      }
+      _incrementalRefactorNonZeros=_incrementalCholesky.nonZeros();
+      _incrementalRoot=rootVertex;
+      _incrementalValid=true;
+    }
+    releaseCholesky(ctx);
+    clearIndexMapping(ctx);
+    // the solution is the gauss-newton step at the new linearization point
+    if (_incrementalValid && _incrementalCholesky.solve(0.))
+      applyIncrementalSolution();
+    return full ? iterations : 1;
+  }
+
   template <typename PG>
   CholOptimizer<PG>::~CholOptimizer<PG>(){
-    if (_sparseB)
-      delete [] _sparseB;
-    if (_sparseMatrix)
-      delete [] _sparseMatrix;
-    delete[]_sparseMatrixPtr; _sparseMatrixPtr = 0;
-    cs_sfree(_symbolicCholesky); _symbolicCholesky = 0;
-    delete[] _csWorkspace; _csWorkspace = 0;
-    delete[] _csInvWorkB; _csInvWorkB = 0;
-    delete[] _csInvWorkTemp; _csInvWorkTemp = 0;
-    delete[] _csIntWorkspace; _csIntWorkspace = 0;
+    releaseCholesky(_context);
+    cs_blocknfree(_covarianceCholesky); _covarianceCholesky = 0;
+    delete _threadPool; _threadPool = 0;
+    pthread_mutex_destroy(&_sharedMutex);
+  }
+
+  template <typename PG>
+  CholOptimizer<PG>::SolverContext::SolverContext(){
+    pool = 0;
+    termination = TERMINATE_ITERATIONS;
+    linearChi2 = 0.;
+    pcgIterations = 0;
+    refinementSteps = 0;
+    relinearizedEdges = 0;
+    linearizationRevision = 0;
+    linearizationCall = 0;
+    csA = 0;
+    sparseB = 0;
+    sparseDim = 0;
+    sparseDimMax = 0;
+    sparseNz = 0;
+    symbolicCholesky = 0;
+    structureHash = 0;
+    numericCholesky = 0;
+    csWorkspaceSize = -1;
+    csWorkspace = 0;
+    csIntWorkspace = 0;
+    csInvWorkspaceSize = -1;
+    csInvWorkB = 0;
+    csInvWorkTemp = 0;
+  }
+
+  template <typename PG>
+  CholOptimizer<PG>::SolverContext::~SolverContext(){
+    assert(! symbolicCholesky && "the symbolic factorization has to be returned to the cache");
+    delete [] sparseB;
+    cs_spfree(csA);
+    cs_blocknfree(numericCholesky);
+    delete[] csWorkspace;
+    delete[] csInvWorkB;
+    delete[] csInvWorkTemp;
+    delete[] csIntWorkspace;
+  }
+
+  template <typename PG>
+  int CholOptimizer<PG>::SolverContext::index(const Graph::Vertex* v) const {
+    typename std::vector< std::pair<const Graph::Vertex*, int> >::const_iterator it=
+      std::lower_bound(vertexIndex.begin(), vertexIndex.end(), std::make_pair(v, -1));
+    if (it==vertexIndex.end() || it->first!=v)
+      return -1;
+    return it->second;
   }
 
   template <typename PG>
   int CholOptimizer<PG>::optimizeSubset(typename PG::Vertex* rootVertex, Graph::VertexSet& vset, int iterations, double lambda, bool initFromObservations,
       int otherNode, typename PG::InformationType* otherCovariance)
+  {
+    return optimizeSubset(defaultContext(), rootVertex, vset, iterations, lambda, initFromObservations, otherNode, otherCovariance);
+  }
+
+  template <typename PG>
+  int CholOptimizer<PG>::optimizeSubset(SolverContext& ctx, typename PG::Vertex* rootVertex, Graph::VertexSet& vset, int iterations, double lambda,
+      bool initFromObservations, int otherNode, typename PG::InformationType* otherCovariance)
   {
     if (vset.size() <= 1) {
       return 0;
     }
-    if (!buildIndexMapping(rootVertex,vset)){
+    if (!buildIndexMapping(ctx, rootVertex,vset)){
       return 0;
     }
-    
-    // clean up from last call
-    if (_symbolicCholesky) {
-      cs_sfree(_symbolicCholesky);
-      _symbolicCholesky = 0;
-    }
+    invalidateCovariances();
+    bool verbose=this->verbose() && &ctx==&_context;
 
-    computeActiveEdges(rootVertex,vset);
+    computeActiveEdges(ctx, rootVertex,vset);
+    buildSparseStructure(ctx);
+    if (_lazyRelinearization && _useRelativeError)
+      prepareLazyLinearization(ctx);
 
     if (initFromObservations){
-      initializeActiveSubsetWithObservations(rootVertex);
-      if (this->verbose()){
+      initializeActiveSubsetWithObservations(ctx, rootVertex);
+      if (verbose){
         cerr << "iteration= " << -1 
           << "\t chi2= " << this->chi2() 
           << "\t time= " << 0.0
@@ -105,30 +777,89 @@ namespace AISNavigation{
     int dim = PG::TransformationVectorType::TemplateSize;
     int cjIterations=0;
     double cumTime=0;
+    double previousChi2=-1.;
+    double firstChi2=-1.;
+    int acceptedLinearizations=0;
+    double updateNorm=-1.;
+    // levenberg marquardt state
+    double mu=-1., nu=2., predictedDecrease=0.;
+    bool damped=false;
+    int rejected=0;
+    ctx.termination=TERMINATE_ITERATIONS;
     for (int i=0; i<iterations; i++){
       struct timeval ts, te;
       gettimeofday(&ts,0);
-      buildLinearSystem(rootVertex,lambda);
-
-      if (i == 0) {
-        // we have to sort the matrix structure only within the first iteration, it stays the same for the following iterations
-        SparseMatrixEntry* entry = _sparseMatrix;
-        for (int j = 0; j < _sparseNz; ++j) { // store the pointer to the array
-          _sparseMatrixPtr[j] = entry;
-          ++entry;
+      buildLinearSystem(ctx, rootVertex,lambda);
+
+      bool accepted=true;
+      if (damped){
+        if (ctx.linearChi2>previousChi2){
+          // reject the step and linearize again at the previous estimate
+          restoreVertices(ctx);
+          buildLinearSystem(ctx, rootVertex,lambda);
+          mu*=nu;
+          nu*=2.;
+          accepted=false;
+          rejected++;
+        } else {
+          double rho=predictedDecrease>0. ? (previousChi2-ctx.linearChi2)/predictedDecrease : 1.;
+          double t=2.*rho-1.;
+          mu*=std::max(1./3., 1.-t*t*t);
+          nu=2.;
+          rejected=0;
         }
-        std::sort(_sparseMatrixPtr, _sparseMatrixPtr + _sparseNz, SparseMatrixEntryPtrCmp());
       }
+      if (accepted && ++acceptedLinearizations==1)
+        firstChi2=ctx.linearChi2;
+      if (accepted && previousChi2>=0.){
+        if (_chi2Tolerance>0. && fabs(previousChi2-ctx.linearChi2)<=_chi2Tolerance*previousChi2)
+          ctx.termination=TERMINATE_CHI2;
+        else if (_updateTolerance>0. && updateNorm<=_updateTolerance)
+          ctx.termination=TERMINATE_UPDATE;
+        else if (_slowConvergenceRatio>0. && acceptedLinearizations==3
+            && previousChi2-ctx.linearChi2>_slowConvergenceRatio*(firstChi2-previousChi2))
+          ctx.termination=TERMINATE_SLOW;
+      }
+      if (rejected>=_maxRejections)
+        ctx.termination=TERMINATE_DAMPING;
+      if (_timeBudget>0. && cumTime>=_timeBudget)
+        ctx.termination=TERMINATE_TIME;
+      if (ctx.termination!=TERMINATE_ITERATIONS && otherNode==-1)
+        break;
+      previousChi2=ctx.linearChi2;
 
-      if (otherNode==-1 || i!=iterations-1){
-	solveAndUpdate();
+      if (otherNode==-1 || (i!=iterations-1 && ctx.termination==TERMINATE_ITERATIONS)){
+        damped=_useLevenbergMarquardt;
+        if (damped){
+          if (mu<0.)
+            mu=1e-5*cs_maxdiagonal_upper(ctx.csA);
+          storeVertices(ctx);
+          cs_adddiagonal_upper(ctx.csA, mu);
+          ctx.dampedRhs.assign(ctx.sparseB, ctx.sparseB+ctx.sparseDim);
+        }
+	solveAndUpdate(ctx);
+        updateNorm=0.;
+        for (int k=0; k<ctx.sparseDim; k++)
+          updateNorm=std::max(updateNorm, fabs(ctx.sparseB[k]));
+        if (damped){
+          // decrease of chi2 predicted by the linear model
+          predictedDecrease=0.;
+          for (int k=0; k<ctx.sparseDim; k++)
+            predictedDecrease+=ctx.sparseB[k]*(mu*ctx.sparseB[k]+ctx.dampedRhs[k]);
+        }
       } else {
-	double** pblock = new double*[dim];
+        // the covariance is taken from the undamped system, with damping the step is discarded
+        damped=false;
+	double* pblock[PG::TransformationVectorType::TemplateSize];
         for (int k = 0; k < dim; ++k)
           pblock[k] = (*otherCovariance)[k];
 	typename PG::Vertex* otherVertex=_MY_CAST_<typename PG::Vertex*>(this->vertex(otherNode));
-	int j=otherVertex->tempIndex()*dim;
-	solveAndUpdate(pblock, j,j,j+dim,j+dim);
+	int j=ctx.index(otherVertex)*dim;
+        if (_useLevenbergMarquardt)
+          storeVertices(ctx);
+	solveAndUpdate(ctx, pblock, j,j,j+dim,j+dim);
+        if (_useLevenbergMarquardt)
+          restoreVertices(ctx);
         static TransformCovariance<PG> tCov;
         tCov(*otherCovariance, rootVertex->transformation, otherVertex->transformation);
 	assert(otherCovariance->det()>0.);
@@ -136,19 +867,32 @@ namespace AISNavigation{
       gettimeofday(&te,0);
       double dts=(te.tv_sec-ts.tv_sec)+1e-6*(te.tv_usec-ts.tv_usec);
       cumTime+=dts;
-      if (this->verbose()){
+      if (verbose){
         cerr << "iteration= " << i 
           << "\t chi2= " << this->chi2() 
           << "\t time= " << dts 
-          << "\t cumTime= " << cumTime
-          << endl;
+          << "\t cumTime= " << cumTime;
+        if (! ctx.edgeCache.empty())
+          cerr << "\t relinearized= " << ctx.relinearizedEdges << "/" << ctx.edgeCache.size();
+        cerr << endl;
       }
-      if (this->visualizeToStdout())
+      if (this->visualizeToStdout() && &ctx==&_context)
 	this->visualizeToStream(cout);
       ++cjIterations;
-
+      if (ctx.termination!=TERMINATE_ITERATIONS)
+        break;
     }
-    clearIndexMapping();
+    if (damped){
+      // the last damped step has not been checked yet
+      buildLinearSystem(ctx, rootVertex,lambda);
+      if (ctx.linearChi2>previousChi2){
+        restoreVertices(ctx);
+        ctx.linearChi2=previousChi2;
+      }
+    }
+    // the symbolic factorization stays in the cache
+    releaseCholesky(ctx);
+    clearIndexMapping(ctx);
 
     return cjIterations;
   }
@@ -156,69 +900,220 @@ namespace AISNavigation{
 
   template <typename PG>
   CholOptimizer<PG>::CholOptimizer(){
-    _sparseB=0;
-    _sparseDim=0;
-    _sparseNz=0;
-    _nBlocks=0;
-    _sparseMatrix=0;
-    _sparseMatrixPtr = 0;
-    _sparseDimMax=0;
-    _sparseNzMax=0;
-    _symbolicCholesky = 0;
-    _csWorkspace = 0;
-    _csIntWorkspace = 0;
-    _csWorkspaceSize = -1;
-    _csInvWorkspaceSize = -1;
-    _csInvWorkB = 0;
-    _csInvWorkTemp = 0;
+    pthread_mutex_init(&_sharedMutex, 0);
+    _ordering = ORDER_AMD;
+    _appendFillRatio = 2.;
+    _appendReferenceFill = 0.;
+    _incremental = false;
+    _numThreads = 1;
+    _threadPool = 0;
+    _threadPoolSize = 0;
+    _linearizeGrainSize = 256;
+    _denseDimension = 48;
+    _usePCG = false;
+    _pcgTolerance = 1e-6;
+    _pcgMaxIterations = 1000;
+    _mixedPrecision = false;
+    _refinementIterations = 10;
+    _refinementTolerance = 1e-10;
+    _lazyRelinearization = false;
+    _lazyTranslationThreshold = 1e-3;
+    _lazyRotationThreshold = 1e-3;
+    _linearizationRevision = 0;
+    _covarianceValid = false;
+    _covarianceRoot = -1;
+    _covarianceCholesky = 0;
+    _incrementalValid = false;
+    _incrementalRoot = 0;
+    _incrementalRefactorNonZeros = 0;
+    _relinearizeThreshold = 0.1;
+    _refactorFillRatio = 2.;
+    _incrementalSolveTolerance = 1e-4;
+    _regionalUpdates = false;
+    _regionDepth = 5;
+    _regionLeakThreshold = 0.1;
+    _regionMaxFraction = 0.5;
+    _lastRegionSize = -1;
+    _fixedLag = 0;
     _useRelativeError=true;
+    _chi2Tolerance=0.;
+    _updateTolerance=0.;
+    _timeBudget=0.;
+    _slowConvergenceRatio=0.;
+    _useLevenbergMarquardt=false;
+    _maxRejections=10;
     _rootNode=-1;
     _addDuplicateEdgeIterations = 3;
   }
 
   template <typename PG>
-  bool CholOptimizer<PG>::buildIndexMapping(typename PG::Vertex* rootVertex, Graph::VertexSet& vset){
-    _ivMap.resize(vset.size());
+  bool CholOptimizer<PG>::buildIndexMapping(SolverContext& ctx, typename PG::Vertex* rootVertex, Graph::VertexSet& vset){
+    ctx.ivMap.resize(vset.size());
+    ctx.vertexIndex.clear();
     int i=0;
     for (Graph::VertexSet::iterator it=vset.begin(); it!=vset.end(); it++){
       typename PG::Vertex* v=_MY_CAST_<typename PG::Vertex*>(*it);
-      if (v!=rootVertex && ! v->fixed()){
-	v->tempIndex()=i;
-	_ivMap[i]=v;
+      if (v!=rootVertex && ! v->fixed() && (_marginalizedIds.empty() || ! _marginalizedIds.count(v->id()))){
+	ctx.vertexIndex.push_back(std::make_pair(static_cast<const Graph::Vertex*>(v), i));
+	ctx.ivMap[i]=v;
 	i++;
       } 
     }
-    _ivMap.resize(i);
+    ctx.ivMap.resize(i);
+    std::sort(ctx.vertexIndex.begin(), ctx.vertexIndex.end());
     return true;
   }
 
   template <typename PG>
-  void CholOptimizer<PG>::clearIndexMapping(){
-    for (int i=0; i<(int)_ivMap.size(); i++){
-      _ivMap[i]->tempIndex()=-1;
-      _ivMap[i]=0;
-    }
+  void CholOptimizer<PG>::clearIndexMapping(SolverContext& ctx){
+    ctx.ivMap.clear();
+    ctx.vertexIndex.clear();
+    ctx.lazyVertices.clear();
+    ctx.edgeCache.clear();
+    ctx.edgePoints.clear();
+    ctx.activePriors.clear();
   }
 
   template <typename PG>
-  void CholOptimizer<PG>::computeActiveEdges(typename PG::Vertex* rootVertex, Graph::VertexSet& vset){
-    _activeEdges.clear();
-    for (int i=0; i<(int)_ivMap.size(); i++){
-      typename PG::Vertex* v=_ivMap[i];
+  void CholOptimizer<PG>::computeActiveEdges(SolverContext& ctx, typename PG::Vertex* rootVertex, Graph::VertexSet& vset){
+    ctx.activeEdges.clear();
+    // the edges of the marginalized vertices are held by the priors
+    bool marginalized=! _marginalizedEdges.empty();
+    for (int i=0; i<(int)ctx.ivMap.size(); i++){
+      typename PG::Vertex* v=ctx.ivMap[i];
       const typename PG::EdgeSet& vEdges=v->edges();
       for (typename PG::EdgeSet::const_iterator it=vEdges.begin(); it!=vEdges.end(); it++){
-	_activeEdges.insert(reinterpret_cast<typename PG::Edge*>(*it));
+        if (marginalized && _marginalizedEdges.count(*it))
+          continue;
+	ctx.activeEdges.insert(reinterpret_cast<typename PG::Edge*>(*it));
       }
     }
     const typename PG::EdgeSet& vEdges=rootVertex->edges();
     for (typename PG::EdgeSet::const_iterator it=vEdges.begin(); it!=vEdges.end(); it++){
-      _activeEdges.insert(reinterpret_cast<typename PG::Edge*>(*it));
+      if (marginalized && _marginalizedEdges.count(*it))
+        continue;
+      ctx.activeEdges.insert(reinterpret_cast<typename PG::Edge*>(*it));
+    }
+    ctx.activeEdgeVector.assign(ctx.activeEdges.begin(), ctx.activeEdges.end());
+    ctx.edgeIndex.resize(ctx.activeEdgeVector.size());
+    for (size_t k=0; k<ctx.activeEdgeVector.size(); k++){
+      const typename PG::Edge* e=ctx.activeEdgeVector[k];
+      ctx.edgeIndex[k]=std::make_pair(ctx.index(e->from()), ctx.index(e->to()));
+    }
+    computeActivePriors(ctx);
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::computeActivePriors(SolverContext& ctx){
+    ctx.activePriors.clear();
+    for (typename std::list<MarginalPrior>::const_iterator it=_priors.begin(); it!=_priors.end(); it++){
+      ActivePrior ap;
+      ap.prior=&*it;
+      bool active=false;
+      for (size_t a=0; a<it->ids.size(); a++){
+        typename PG::Vertex* v=_MY_CAST_<typename PG::Vertex*>(this->vertex(it->ids[a]));
+        ap.vertices.push_back(v);
+        ap.index.push_back(ctx.index(v));
+        active = active || ap.index.back()!=-1;
+      }
+      if (active)
+        ctx.activePriors.push_back(ap);
     }
   }
 
+  template <typename PG>
+  void CholOptimizer<PG>::computeBlockRows(const SolverContext& ctx, std::vector< std::vector<int> >& blockRows) const {
+    int nBlocks = ctx.ivMap.size();
+    blockRows.assign(nBlocks, std::vector<int>());
+    for (size_t k=0; k<ctx.edgeIndex.size(); k++){
+      int i=ctx.edgeIndex[k].first;
+      int j=ctx.edgeIndex[k].second;
+      if (i==-1 || j==-1)
+        continue;
+      blockRows[std::max(i,j)].push_back(std::min(i,j));
+    }
+    for (size_t p=0; p<ctx.activePriors.size(); p++){
+      const std::vector<int>& index=ctx.activePriors[p].index;
+      for (size_t a=0; a<index.size(); a++)
+        for (size_t b=a+1; b<index.size(); b++)
+          if (index[a]!=-1 && index[b]!=-1)
+            blockRows[std::max(index[a],index[b])].push_back(std::min(index[a],index[b]));
+    }
+    for (int i=0; i<nBlocks; i++){
+      std::vector<int>& rows=blockRows[i];
+      rows.push_back(i);
+      std::sort(rows.begin(), rows.end());
+      rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    }
+  }
 
   template <typename PG>
-  int CholOptimizer<PG>::linearizeConstraint(const typename PG::Edge* e, double lambda){
+  void CholOptimizer<PG>::buildSparseStructure(SolverContext& ctx){
+    int nBlocks = ctx.ivMap.size();
+
+    // upper triangular block pattern, it does not change within one subset
+    std::vector< std::vector<int> > blockRows;
+    computeBlockRows(ctx, blockRows);
+
+    // the block pattern and the ordering identify the symbolic factorization in the cache
+    ctx.structureSignature.clear();
+    ctx.structureSignature.push_back(nBlocks);
+    for (int i=0; i<nBlocks; i++){
+      ctx.structureSignature.push_back(blockRows[i].size());
+      ctx.structureSignature.insert(ctx.structureSignature.end(), blockRows[i].begin(), blockRows[i].end());
+    }
+    ctx.structureSignature.push_back(_ordering);
+    if (_ordering==ORDER_APPEND){
+      computeAppendOrdering(ctx);
+      ctx.structureSignature.insert(ctx.structureSignature.end(), ctx.appendPermutation.begin(), ctx.appendPermutation.end());
+    }
+    ctx.structureHash=SymbolicCholeskyCache::hashSignature(ctx.structureSignature);
+
+    allocateSparseSystem(ctx, blockRows);
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::allocateSparseSystem(SolverContext& ctx, const std::vector< std::vector<int> >& blockRows){
+    int dim = PG::TransformationVectorType::TemplateSize;
+    int nBlocks = ctx.ivMap.size();
+    ctx.csA=cs_blockpattern_upper(blockRows, dim, ctx.csA);
+    ctx.sparseDim=ctx.csA->n;
+    ctx.sparseNz=ctx.csA->p[ctx.sparseDim];
+    if (ctx.sparseDim>ctx.sparseDimMax){
+      delete [] ctx.sparseB;
+      ctx.sparseDimMax=2*ctx.sparseDim;
+      ctx.sparseB = new double [ctx.sparseDimMax];
+    }
+
+    ctx.diagBlockOffset.resize(nBlocks);
+    for (int i=0; i<nBlocks; i++){
+      ctx.diagBlockOffset[i]=(blockRows[i].size()-1)*dim;
+    }
+    ctx.edgeBlockOffset.resize(ctx.activeEdgeVector.size());
+    for (size_t k=0; k<ctx.edgeIndex.size(); k++){
+      int i=ctx.edgeIndex[k].first;
+      int j=ctx.edgeIndex[k].second;
+      if (i==-1 || j==-1){
+        ctx.edgeBlockOffset[k]=-1;
+        continue;
+      }
+      ctx.edgeBlockOffset[k]=cs_blockoffset(blockRows, std::min(i,j), std::max(i,j), dim);
+    }
+    for (size_t p=0; p<ctx.activePriors.size(); p++){
+      ActivePrior& ap=ctx.activePriors[p];
+      int n=ap.index.size();
+      ap.blockOffset.assign(n*n, -1);
+      for (int a=0; a<n; a++)
+        for (int b=a+1; b<n; b++){
+          int i=ap.index[a], j=ap.index[b];
+          if (i!=-1 && j!=-1)
+            ap.blockOffset[a*n+b]=cs_blockoffset(blockRows, std::min(i,j), std::max(i,j), dim);
+        }
+    }
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::linearizeConstraint(const typename PG::Edge* e, int i, int j, double lambda, LinearizedConstraint& lc) const {
       typename PG::TransformationVectorType f;
       typename PG::InformationType A, B;
       if (_useRelativeError){
@@ -234,12 +1129,10 @@ namespace AISNavigation{
       const typename PG::Vertex* from=_MY_CAST_<const typename PG::Vertex*>(e->from());
       const typename PG::Vertex* to=_MY_CAST_<const typename PG::Vertex*>(e->to());
 
-      int i=from->tempIndex();
       if(i==-1){
 	A = PG::InformationType::eye(1.);
       }
 
-      int j=to->tempIndex();
       if(j==-1){
 	B = PG::InformationType::eye(1.);
       }
@@ -248,21 +1141,152 @@ namespace AISNavigation{
 	lambda=1.;
       if (i==-1 || j==-1)
 	omega=omega*lambda;
+      lc.i=i;
+      lc.j=j;
+      lc.chi2=r*(omega*r);
       if (i!=-1){
-	typename PG::TransformationVectorType bi=A.transpose()*(omega*r);
-	typename PG::InformationType Aii = A.transpose()*omega*A;
-	from->b()+=bi;
-	from->A()+=Aii;
+	lc.bi=A.transpose()*(omega*r);
+	lc.Aii = A.transpose()*omega*A;
       }
       if (j!=-1){
-	typename PG::TransformationVectorType bj=B.transpose()*(omega*r);      
-	typename PG::InformationType Ajj = B.transpose()*omega*B;
-	to->b()+=bj;
-	to->A()+=Ajj;
+	lc.bj=B.transpose()*(omega*r);      
+	lc.Ajj = B.transpose()*omega*B;
       }
       if (i!=-1 && j!=-1){
-	typename PG::InformationType Aij = A.transpose()*omega*B;
-	e->AFromTo()+=Aij;
+	lc.Aij = A.transpose()*omega*B;
+      }
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::linearizeConstraintLazy(const typename PG::Edge* e, int i, int j, double lambda, EdgeLinearization& el, bool relinearize,
+      LinearizedConstraint& lc) const {
+      typename PG::TransformationVectorType f;
+      typename PG::InformationType omega=e->information();
+      if (relinearize){
+        // the blocks are stored for the full information, the weight of the edge is applied below
+	typename PG::InformationType A, B;
+	static ManifoldGradient<PG> gradient;
+	gradient(f,A,B,*e);
+	el.AtOmega = A.transpose()*omega;
+	el.BtOmega = B.transpose()*omega;
+	el.Aii = el.AtOmega*A;
+	el.Ajj = el.BtOmega*B;
+	el.Aij = el.AtOmega*B;
+      } else {
+	static ManifoldError<PG> error;
+	error(f,*e);
+      }
+      typename PG::TransformationVectorType r=f*(-1.);
+
+      const typename PG::Vertex* from=_MY_CAST_<const typename PG::Vertex*>(e->from());
+      const typename PG::Vertex* to=_MY_CAST_<const typename PG::Vertex*>(e->to());
+      if (from->fixed() || to->fixed())
+	lambda=1.;
+      double w = (i==-1 || j==-1) ? lambda : 1.;
+      lc.i=i;
+      lc.j=j;
+      lc.chi2=w*(r*(omega*r));
+      if (i!=-1){
+	lc.bi=(el.AtOmega*r)*w;
+	lc.Aii=el.Aii*w;
+      }
+      if (j!=-1){
+	lc.bj=(el.BtOmega*r)*w;
+	lc.Ajj=el.Ajj*w;
+      }
+      if (i!=-1 && j!=-1){
+	lc.Aij=el.Aij;
+      }
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::linearizeEdge(const SolverContext& ctx, int k, double lambda, LinearizedConstraint& lc) const {
+    const typename PG::Edge* e=ctx.activeEdgeVector[k];
+    int i=ctx.edgeIndex[k].first;
+    int j=ctx.edgeIndex[k].second;
+    if (ctx.edgeCache.empty())
+      linearizeConstraint(e, i, j, lambda, lc);
+    else
+      linearizeConstraintLazy(e, i, j, lambda, *ctx.edgeCache[k], ctx.relinearize[k], lc);
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::prepareLazyLinearization(SolverContext& ctx){
+    if (ctx.linearizationRevision!=_linearizationRevision){
+      // an edge has been refined or removed, the addresses may be reused
+      ctx.edgeLinearizations.clear();
+      ctx.linearizationPoints.clear();
+      ctx.linearizationRevision=_linearizationRevision;
+    }
+    int call=++ctx.linearizationCall;
+    int nEdges=ctx.activeEdgeVector.size();
+    ctx.edgeCache.resize(nEdges);
+    ctx.edgePoints.resize(nEdges);
+    ctx.relinearize.resize(nEdges);
+    ctx.lazyVertices.clear();
+    for (int k=0; k<nEdges; k++){
+      const typename PG::Edge* e=ctx.activeEdgeVector[k];
+      ctx.edgeCache[k]=&ctx.edgeLinearizations[e];
+      const typename PG::Vertex* v[2]={_MY_CAST_<const typename PG::Vertex*>(e->from()), _MY_CAST_<const typename PG::Vertex*>(e->to())};
+      LinearizationPoint* p[2];
+      for (int q=0; q<2; q++){
+        p[q]=&ctx.linearizationPoints[v[q]];
+        if (p[q]->call!=call){
+          p[q]->call=call;
+          ctx.lazyVertices.push_back(std::make_pair(v[q], p[q]));
+        }
+      }
+      ctx.edgePoints[k]=std::make_pair(p[0], p[1]);
+    }
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::updateLinearizationPoints(SolverContext& ctx){
+    for (size_t k=0; k<ctx.lazyVertices.size(); k++){
+      const typename PG::Vertex* v=ctx.lazyVertices[k].first;
+      LinearizationPoint* p=ctx.lazyVertices[k].second;
+      bool moved=p->stamp==0;
+      if (! moved){
+        double t, r;
+        motion(p->pose, v->transformation, t, r);
+        moved = t>_lazyTranslationThreshold || r>_lazyRotationThreshold;
+      }
+      if (moved){
+        p->pose=v->transformation;
+        p->stamp++;
+      }
+    }
+    ctx.relinearizedEdges=0;
+    for (size_t k=0; k<ctx.edgeCache.size(); k++){
+      EdgeLinearization* el=ctx.edgeCache[k];
+      bool stale = el->fromStamp!=ctx.edgePoints[k].first->stamp || el->toStamp!=ctx.edgePoints[k].second->stamp;
+      if (stale){
+        el->fromStamp=ctx.edgePoints[k].first->stamp;
+        el->toStamp=ctx.edgePoints[k].second->stamp;
+        ctx.relinearizedEdges++;
+      }
+      ctx.relinearize[k]=stale;
+    }
+  }
+
+  template <typename PG>
+  int CholOptimizer<PG>::accumulateConstraint(SolverContext& ctx, const LinearizedConstraint& lc, int offset){
+      int dim = PG::TransformationVectorType::TemplateSize;
+      int i=lc.i;
+      int j=lc.j;
+      ctx.linearChi2+=lc.chi2;
+      if (i!=-1){
+	for (int k=0; k<dim; k++)
+	  ctx.sparseB[i*dim+k]+=lc.bi[k];
+	cs_blockadd_upper(ctx.csA, i, i, ctx.diagBlockOffset[i], lc.Aii, dim);
+      }
+      if (j!=-1){
+	for (int k=0; k<dim; k++)
+	  ctx.sparseB[j*dim+k]+=lc.bj[k];
+	cs_blockadd_upper(ctx.csA, j, j, ctx.diagBlockOffset[j], lc.Ajj, dim);
+      }
+      if (i!=-1 && j!=-1){
+	cs_blockadd_upper(ctx.csA, i, j, offset, lc.Aij, dim);
 	return 2;
       }
       return 0;
@@ -270,6 +1294,7 @@ namespace AISNavigation{
 
   template <typename PG>
   typename PG::Edge* CholOptimizer<PG>::addEdge(typename PG::Vertex* from, typename PG::Vertex* to, const typename PG::TransformationType& mean, const typename PG::InformationType& information){
+    invalidateCovariances();
     Graph::EdgeSet eset1=this->connectingEdges(from, to);
     Graph::EdgeSet eset2=this->connectingEdges(to, from);
     Graph::EdgeSet eset;
@@ -277,13 +1302,17 @@ namespace AISNavigation{
 		   eset1.end(),
 		   eset2.begin(),
 		   eset2.end(), 
-		   std::insert_iterator<Graph::EdgeSet>(eset, eset.end()));
+		   std::insert_iterator<Graph::EdgeSet>(eset, eset.end()),
+		   Graph::EdgeIDCompare());
 
     if (eset.empty()){
       typename PG::Edge* e = PG::addEdge(from, to, mean, information);
       if (_guessOnEdges && to->edges().size()==1 && ! to->fixed()){
 	to->transformation=from->transformation*mean;
       }
+      if (_incremental && e)
+        _incrementalPendingEdges.push_back(e);
+      markAffected(e);
       return e;
     }
     assert(eset.size()==1);
@@ -349,178 +1378,453 @@ namespace AISNavigation{
     }
 
     this->refineEdge(origEdge, newMean, newInfo);
+    // the old measurement is part of the incremental factor
+    _incrementalValid = false;
     return origEdge;
 
   }
 
 
   template <typename PG>
-  void CholOptimizer<PG>::buildLinearSystem(typename PG::Vertex* rootVertex, double lambda){
-    for (int i=0; i<(int)_ivMap.size(); i++){
-      typename PG::Vertex* v=_ivMap[i];
-      assert(v);
-      assert(v!=rootVertex);
-      v->b().fill(0.0);
-      v->A().fill(0.0);
+  void CholOptimizer<PG>::refineEdge(typename PG::Edge* e, const typename PG::TransformationType& mean, const typename PG::InformationType& information){
+    invalidateCovariances();
+    _linearizationRevision++;
+    markAffected(e);
+    PG::refineEdge(e, mean, information);
+  }
+
+  template <typename PG>
+  typename PG::Vertex* CholOptimizer<PG>::addVertex(const int& k){
+    typename PG::Vertex* v=PG::addVertex(k);
+    if (v && _fixedLag>0)
+      _lagWindow.push_back(k);
+    return v;
+  }
+
+  template <typename PG>
+  typename PG::Vertex* CholOptimizer<PG>::addVertex(int id, const typename PG::TransformationType& pose, const typename PG::InformationType& information){
+    typename PG::Vertex* v=PG::addVertex(id, pose, information);
+    if (v && _fixedLag>0)
+      _lagWindow.push_back(id);
+    return v;
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::removeEdge(Graph::Edge* e){
+    invalidateCovariances();
+    _linearizationRevision++;
+    markAffected(e);
+    _marginalizedEdges.erase(e);
+    _incrementalValid = false;
+    _incrementalPendingEdges.clear();
+    return PG::removeEdge(e);
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::removeVertex(Graph::Vertex* v){
+    invalidateCovariances();
+    _linearizationRevision++;
+    if (_marginalizedIds.erase(v->id())==0){
+      std::deque<int>::iterator w=std::find(_lagWindow.begin(), _lagWindow.end(), v->id());
+      if (w!=_lagWindow.end())
+        _lagWindow.erase(w);
+      // the priors on the vertex are dropped
+      for (typename std::list<MarginalPrior>::iterator it=_priors.begin(); it!=_priors.end(); ){
+        if (std::find(it->ids.begin(), it->ids.end(), v->id())!=it->ids.end())
+          it=_priors.erase(it);
+        else
+          it++;
+      }
     }
-    // compute the terms for the pairwise constraints
-    for (typename std::set<typename PG::Edge*>::const_iterator it=_activeEdges.begin(); it!=_activeEdges.end(); it++){
-      const typename PG::Edge* e=*it;
-      e->AFromTo().fill(0.0);
+    _incrementalValid = false;
+    _incrementalPendingEdges.clear();
+    return PG::removeVertex(v);
+  }
+
+
+  template <typename PG>
+  struct CholOptimizer<PG>::LinearizeTask : public ThreadPool::RangeTask
+  {
+    const CholOptimizer<PG>* optimizer;
+    const SolverContext* ctx;
+    LinearizedConstraint* output;
+    const typename PG::Vertex* rootVertex;
+    double lambda;
+    virtual void run(int begin, int end, int)
+    {
+      for (int k=begin; k<end; k++){
+        const typename PG::Edge* e=ctx->activeEdgeVector[k];
+        double l=lambda;
+        if (e->from()==rootVertex || e->to()==rootVertex)
+          l=1;
+        optimizer->linearizeEdge(*ctx, k, l, output[k]);
+      }
     }
-    int blockCount=0;
-    for (typename set<typename PG::Edge*>::const_iterator it=_activeEdges.begin(); it!=_activeEdges.end(); it++){
-      const typename PG::Edge* e=*it;
-      double l=lambda;
-      if (e->from()==rootVertex || e->to()==rootVertex)
-        l=1;
-      blockCount+= linearizeConstraint(e, l);
+  };
+
+  template <typename PG>
+  ThreadPool* CholOptimizer<PG>::threadPool(){
+    if (_numThreads==1)
+      return 0;
+    if (! _threadPool || _threadPoolSize!=_numThreads){
+      delete _threadPool;
+      _threadPool=new ThreadPool(_numThreads);
+      _threadPoolSize=_numThreads;
     }
+    return _threadPool;
+  }
 
-    int dim = PG::TransformationVectorType::TemplateSize;
-    assert(dim > 0);
+  template <typename PG>
+  typename CholOptimizer<PG>::SolverContext& CholOptimizer<PG>::defaultContext(){
+    _context.pool=threadPool();
+    return _context;
+  }
 
-    blockCount+=_ivMap.size();
+  template <typename PG>
+  void CholOptimizer<PG>::releaseCholesky(SolverContext& ctx){
+    if (! ctx.symbolicCholesky)
+      return;
+    pthread_mutex_lock(&_sharedMutex);
+    _symbolicCache.release(ctx.symbolicCholesky);
+    pthread_mutex_unlock(&_sharedMutex);
+    ctx.symbolicCholesky=0;
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::buildLinearSystem(SolverContext& ctx, typename PG::Vertex* rootVertex, double lambda){
+    // the pattern of ctx.csA has been built by buildSparseStructure(ctx), here we only refill the values
+    std::fill(ctx.csA->x, ctx.csA->x+ctx.sparseNz, 0.);
+    std::fill(ctx.sparseB, ctx.sparseB+ctx.sparseDim, 0.);
+    ctx.linearChi2=0.;
+    ThreadPool* pool=ctx.pool;
+    int nEdges=ctx.activeEdgeVector.size();
+    if (ctx.edgeCache.empty())
+      ctx.relinearizedEdges=nEdges;
+    else
+      updateLinearizationPoints(ctx);
+    if (! pool || nEdges < 2*_linearizeGrainSize){
+      LinearizedConstraint lc;
+      for (int k=0; k<nEdges; k++){
+        const typename PG::Edge* e=ctx.activeEdgeVector[k];
+        double l=lambda;
+        if (e->from()==rootVertex || e->to()==rootVertex)
+          l=1;
+        linearizeEdge(ctx, k, l, lc);
+        accumulateConstraint(ctx, lc, ctx.edgeBlockOffset[k]);
+      }
+      accumulatePriors(ctx);
+      return;
+    }
 
-    _sparseDim=_ivMap.size()*dim;
-    _nBlocks=blockCount;
-    _sparseNz=0;
+    // the jacobians are computed in parallel, the accumulation is serial in the order of the edges
+    // to yield the same result as the serial code
+    ctx.linearizedConstraints.resize(nEdges);
+    LinearizeTask task;
+    task.optimizer=this;
+    task.ctx=&ctx;
+    task.output=&ctx.linearizedConstraints[0];
+    task.rootVertex=rootVertex;
+    task.lambda=lambda;
+    pool->parallelFor(nEdges, _linearizeGrainSize, task);
+    for (int k=0; k<nEdges; k++)
+      accumulateConstraint(ctx, ctx.linearizedConstraints[k], ctx.edgeBlockOffset[k]);
+    accumulatePriors(ctx);
+  }
 
-    int sparseNzCurr=_nBlocks*dim*dim;
-    if (_sparseDim>_sparseDimMax){
-      if (_sparseB ) {
-	delete [] _sparseB;
-        _sparseB = 0;
+  template <typename PG>
+  void CholOptimizer<PG>::accumulatePriors(SolverContext& ctx){
+    int dim = PG::TransformationVectorType::TemplateSize;
+    static PoseDifference<PG> difference;
+    for (size_t p=0; p<ctx.activePriors.size(); p++){
+      const ActivePrior& ap=ctx.activePriors[p];
+      const MarginalPrior& prior=*ap.prior;
+      int n=ap.index.size();
+      int N=n*dim;
+      // the displacement from the linearization point and the right hand side b-H*d
+      ctx.priorWorkspace.resize(2*N);
+      double* d=&ctx.priorWorkspace[0];
+      double* r=d+N;
+      for (int a=0; a<n; a++){
+        typename PG::TransformationVectorType da;
+        difference(da, prior.poses[a], ap.vertices[a]->transformation);
+        for (int k=0; k<dim; k++)
+          d[a*dim+k]=da[k];
+      }
+      double chi2=prior.chi2;
+      for (int q=0; q<N; q++){
+        const double* Hq=&prior.H[q*N];
+        double Hd=0.;
+        for (int c=0; c<N; c++)
+          Hd+=Hq[c]*d[c];
+        r[q]=prior.b[q]-Hd;
+        chi2+=d[q]*(Hd-2.*prior.b[q]);
+      }
+      ctx.linearChi2+=chi2;
+      typename PG::InformationType m;
+      for (int a=0; a<n; a++){
+        int i=ap.index[a];
+        if (i==-1)
+          continue;
+        for (int k=0; k<dim; k++)
+          ctx.sparseB[i*dim+k]+=r[a*dim+k];
+        for (int b=a; b<n; b++){
+          int j=ap.index[b];
+          if (j==-1)
+            continue;
+          for (int q=0; q<dim; q++)
+            for (int k=0; k<dim; k++)
+              m[q][k]=prior.H[(a*dim+q)*N+b*dim+k];
+          cs_blockadd_upper(ctx.csA, i, j, a==b ? ctx.diagBlockOffset[i] : ap.blockOffset[a*n+b], m, dim);
+        }
       }
-      _sparseDimMax=_sparseDim*2;
-      _sparseB = new double [_sparseDimMax];
-      for (int i = 0; i < _sparseDimMax; ++i)
-        _sparseB[i] = 0;
     }
-    if (sparseNzCurr>_sparseNzMax){
-      if (_sparseMatrix)
-        delete [] _sparseMatrix;
-      _sparseNzMax=2*sparseNzCurr;
-      _sparseMatrix = new SparseMatrixEntry[_sparseNzMax];
-      delete[] _sparseMatrixPtr;
-      _sparseMatrixPtr = new SparseMatrixEntry*[_sparseNzMax];
+  }
+
+
+  template <typename PG>
+  void CholOptimizer<PG>::computeAppendOrdering(SolverContext& ctx){
+    // the vertices of the previous elimination order which are still in the subset, then the new ones
+    int nBlocks=ctx.ivMap.size();
+    std::vector<bool> taken(nBlocks, false);
+    ctx.appendPermutation.clear();
+    pthread_mutex_lock(&_sharedMutex);
+    if (_previousOrder.empty()){
+      pthread_mutex_unlock(&_sharedMutex);
+      return;
+    }
+    for (size_t k=0; k<_previousOrder.size(); k++){
+      typename PG::Vertex* v=_MY_CAST_<typename PG::Vertex*>(this->vertex(_previousOrder[k]));
+      if (! v)
+        continue;
+      int i=ctx.index(v);
+      if (i<0 || i>=nBlocks || ctx.ivMap[i]!=v || taken[i])
+        continue;
+      taken[i]=true;
+      ctx.appendPermutation.push_back(i);
     }
+    pthread_mutex_unlock(&_sharedMutex);
+    for (int i=0; i<nBlocks; i++)
+      if (! taken[i])
+        ctx.appendPermutation.push_back(i);
+  }
 
-    
-    SparseMatrixEntry* entry=_sparseMatrix;
-    int nz=0;
-    for (int i=0; i<(int)_ivMap.size(); i++){
-      typename PG::Vertex* v=_ivMap[i];
-      assert(v);
-      int iBase=i*dim;
-      for (int j=0; j<dim; j++)
-	_sparseB[iBase+j]=v->b()[j];
-      typename PG::InformationType& Ai=v->A();
-      for (int j=0; j<dim; j++)
-	for (int k=0; k<dim; k++){
-	  int r=iBase+j;
-	  int c=iBase+k;
-	  double v=Ai[j][k];
-	  entry->set(r,c,v);
-	  nz++;
-	  entry++;
-	}
-    }
-    for (typename std::set<typename PG::Edge*>::const_iterator it=_activeEdges.begin();
-        it!=_activeEdges.end();
-        it++){
-      const typename PG::Edge* e=*it;
-      const typename PG::Vertex* from=_MY_CAST_<const typename PG::Vertex*>(e->from());
-      const typename PG::Vertex* to=_MY_CAST_<const typename PG::Vertex*>(e->to());
-      typename PG::InformationType Aij=e->AFromTo();
+  template <typename PG>
+  css* CholOptimizer<PG>::symbolicAnalysis(SolverContext& ctx){
+    int dim = PG::TransformationVectorType::TemplateSize;
+    struct timeval ts, te;
+    gettimeofday(&ts,0);
+    css* S=0;
+    double nnzL=0.;
+    if (_ordering==ORDER_APPEND){
+      // the appended order is dropped once its fill exceeds the one of the last AMD ordering by appendFillRatio()
+      double nnzA=ctx.csA->p[ctx.csA->n];
+      if (! ctx.appendPermutation.empty()){
+        S = cs_blockschol_perm(&ctx.appendPermutation[0], ctx.csA, dim);
+        if (S)
+          cs_blockcholstats(S, ctx.ivMap.size(), dim, &nnzL, 0);
+        if (S && nnzL > _appendFillRatio * _appendReferenceFill * nnzA)
+          S = cs_sfree(S);
+      }
+      if (! S){
+        S = cs_blockschol(CS_ORDER_AMD, ctx.csA, dim);
+        if (S){
+          cs_blockcholstats(S, ctx.ivMap.size(), dim, &nnzL, 0);
+          _appendReferenceFill = nnzL / nnzA;
+        }
+      }
+    } else
+      S = cs_blockschol(_ordering, ctx.csA, dim);
+    gettimeofday(&te,0);
+    if (! S)
+      return 0;
+    OrderingStatistics& stats=_orderingStatistics[_ordering];
+    stats.analyses++;
+    stats.time+=(te.tv_sec-ts.tv_sec)+1e-6*(te.tv_usec-ts.tv_usec);
+    cs_blockcholstats(S, ctx.ivMap.size(), dim, &stats.nnzL, &stats.flops);
+    return S;
+  }
 
-      int i=from->tempIndex();
-      int j=to->tempIndex();
-      if (i==-1 || j==-1)
-	continue;
-
-      for (int symm=0; symm<2; symm++){
-	int iBase=i*dim;
-	int jBase=j*dim;
-	if (symm){
-	  Aij.transposeInPlace();
-	  iBase=j*dim;
-	  jBase=i*dim;
-	}
-	for (int q=0; q<dim; q++)
-	  for (int k=0; k<dim; k++){
-	    int r=iBase+q;
-	    int c=jBase+k;
-	    double v=Aij[q][k];
-	    entry->set(r,c,v);
-	    nz++;
-	    entry++;
-	  }
-      }
-    }
-    _sparseNz=nz;
-    //if (_sparseNz!=_nBlocks*dim*dim){
-      //cerr << "FATAL: _sparseNz=" <<  _sparseNz << " nBlocks*9=" << _nBlocks*9 << "sparseNzCurr" << sparseNzCurr << endl;
-    //}
-    assert (_sparseNz==_nBlocks*dim*dim);
-  }
-
-
-  template <typename PG>
-  void CholOptimizer<PG>::solveAndUpdate(double** block, int r1, int c1, int r2, int c2){
-    //cerr << "csparse_create"<< endl;
-    struct cs_sparse *_csA=SparseMatrixEntryPtrVector2CSparse(_sparseMatrixPtr, _sparseDim, _sparseDim, _sparseNz);
-    //cs_print(_csA, 0);
-    struct cs_sparse *_ccsA=cs_compress(_csA);
-    //cerr << "solving";
-    
-    // perform symbolic cholesky once
-    if (_symbolicCholesky == 0) {
-      _symbolicCholesky = cs_schol (1, _ccsA) ;
-      if (!_symbolicCholesky) {
-        cerr << "Symbolic cholesky failed" << endl;
+  template <typename PG>
+  void CholOptimizer<PG>::prepareCholesky(SolverContext& ctx, bool singlePrecision){
+    struct cs_sparse *_ccsA=ctx.csA;
+    int dim = PG::TransformationVectorType::TemplateSize;
+    // perform symbolic cholesky once, the analysis is carried out on the pose blocks
+    // and re-used for subsets having the same structure
+    if (ctx.symbolicCholesky == 0) {
+      // the cache and the orderings are shared by all contexts, the analysis is serialized
+      pthread_mutex_lock(&_sharedMutex);
+      ctx.symbolicCholesky = _symbolicCache.find(ctx.structureSignature, ctx.structureHash);
+      if (!ctx.symbolicCholesky) {
+        ctx.symbolicCholesky = symbolicAnalysis(ctx);
+        if (!ctx.symbolicCholesky) {
+          cerr << "Symbolic cholesky failed" << endl;
+        }
+        _symbolicCache.insert(ctx.structureSignature, ctx.structureHash, ctx.symbolicCholesky);
+      }
+      if (_ordering==ORDER_APPEND && ctx.symbolicCholesky){
+        // elimination order of this analysis for the next one
+        _previousOrder.resize(ctx.ivMap.size());
+        for (size_t i=0; i<ctx.ivMap.size(); i++){
+          int k = ctx.symbolicCholesky->pinv ? ctx.symbolicCholesky->pinv[i] : i;
+          _previousOrder[k]=ctx.ivMap[i]->id();
+        }
       }
+      pthread_mutex_unlock(&_sharedMutex);
+      // storage of the factor and the gather map, refilled in place until the symbolic analysis changes
+      ctx.numericCholesky = cs_blockchol_alloc(_ccsA, ctx.symbolicCholesky, dim, ctx.numericCholesky, singlePrecision);
+    } else if (ctx.numericCholesky && (ctx.numericCholesky->xf != 0) != singlePrecision) {
+      ctx.numericCholesky = cs_blockchol_alloc(_ccsA, ctx.symbolicCholesky, dim, ctx.numericCholesky, singlePrecision);
     }
     // re-allocate the temporary workspace for cholesky
-    if (_csWorkspaceSize < _ccsA->n) {
-      _csWorkspaceSize = 2 * _ccsA->n;
-      delete[] _csWorkspace;
-      _csWorkspace = new double[_csWorkspaceSize];
-      delete[] _csIntWorkspace;
-      _csIntWorkspace = new int[2*_csWorkspaceSize];
+    // the first n entries hold the solution, the remaining n*dim the dense block column
+    if (ctx.csWorkspaceSize < _ccsA->n * (dim + 1)) {
+      ctx.csWorkspaceSize = 2 * _ccsA->n * (dim + 1);
+      delete[] ctx.csWorkspace;
+      ctx.csWorkspace = new double[ctx.csWorkspaceSize];
+      delete[] ctx.csIntWorkspace;
+      ctx.csIntWorkspace = new int[4 * _ccsA->n];
+    }
+  }
+
+
+  template <typename PG>
+  bool CholOptimizer<PG>::solvePCG(SolverContext& ctx, double** block, int r1, int c1, int r2, int c2){
+    int dim = PG::TransformationVectorType::TemplateSize;
+    int n = ctx.sparseDim;
+    // block Jacobi preconditioner from the diagonal block of each vertex
+    ctx.pcgPreconditioner.resize(ctx.ivMap.size()*dim*dim);
+    double* Minv = &ctx.pcgPreconditioner[0];
+    for (size_t i=0; i<ctx.ivMap.size(); i++){
+      typename PG::InformationType Aii;
+      cs_blockget_diagonal(ctx.csA, i, ctx.diagBlockOffset[i], Aii, dim);
+      typename PG::InformationType inv=Aii.inverse();
+      for (int c=0; c<dim; c++)
+        for (int r=0; r<dim; r++)
+          *Minv++ = inv[r][c];
+    }
+    ctx.pcgWorkspace.resize(6*n);
+    double* x = &ctx.pcgWorkspace[0];
+    double* e = x + n;
+    double* work = x + 2*n;
+
+    std::fill(x, x+n, 0.);
+    ctx.pcgIterations = cs_blockpcg(ctx.csA, ctx.sparseB, x, &ctx.pcgPreconditioner[0], dim, _pcgTolerance, _pcgMaxIterations, work);
+    if (ctx.pcgIterations < 0)
+      return false;
+    if (block){
+      // columns of the inverse, each one requires a solve
+      std::fill(e, e+n, 0.);
+      for (int i=c1; i<c2; i++){
+        e[i]=1.;
+        std::fill(ctx.sparseB, ctx.sparseB+n, 0.);
+        if (cs_blockpcg(ctx.csA, e, ctx.sparseB, &ctx.pcgPreconditioner[0], dim, _pcgTolerance, _pcgMaxIterations, work) < 0)
+          return false;
+        for (int j=r1; j<r2; j++)
+          block[j-r1][i-c1]=ctx.sparseB[j];
+        e[i]=0.;
+      }
     }
+    std::copy(x, x+n, ctx.sparseB);
+    return true;
+  }
 
+  template <typename PG>
+  bool CholOptimizer<PG>::solveDense(SolverContext& ctx, double** block, int r1, int c1, int r2, int c2){
+    int dim = PG::TransformationVectorType::TemplateSize;
+    int n = ctx.sparseDim;
+    int nb = n/dim;
+    ctx.denseCholesky.resize(nb*nb*dim*dim);
+    ctx.denseNonZero.resize(nb*nb);
+    cs_blockdense_lower(ctx.csA, dim, &ctx.denseCholesky[0], &ctx.denseNonZero[0]);
+    if (! cs_blockdensechol(&ctx.denseCholesky[0], nb, dim, &ctx.denseNonZero[0]))
+      return false;
+    if (block){
+      // A^-1 = L^-T*L^-1, the entry (j,i) is the dot product of the columns j and i of L^-1
+      int rows=r2-r1, cols=c2-c1;
+      ctx.denseWorkspace.resize((rows+cols)*n);
+      double* Y = &ctx.denseWorkspace[0];
+      std::fill(Y, Y+(rows+cols)*n, 0.);
+      for (int k=0; k<rows+cols; k++){
+        double* y = Y + k*n;
+        int i = k<rows ? r1+k : c1+k-rows;
+        y[i]=1.;
+        cs_blockdenselsolve(&ctx.denseCholesky[0], nb, dim, &ctx.denseNonZero[0], y, i/dim);
+      }
+      for (int j=0; j<rows; j++)
+        for (int i=0; i<cols; i++){
+          const double* yj = Y + j*n;
+          const double* yi = Y + (rows+i)*n;
+          double v=0.;
+          for (int k=std::max(r1+j, c1+i)/dim*dim; k<n; k++)
+            v += yj[k]*yi[k];
+          block[j][i]=v;
+        }
+    }
+    cs_blockdensesolve(&ctx.denseCholesky[0], nb, dim, &ctx.denseNonZero[0], ctx.sparseB);
+    return true;
+  }
+
+  template <typename PG>
+  void CholOptimizer<PG>::solveAndUpdate(SolverContext& ctx, double** block, int r1, int c1, int r2, int c2){
+    struct cs_sparse *_ccsA=ctx.csA;
+    int dim = PG::TransformationVectorType::TemplateSize;
     int ok=0;
-    if (! block){
-      ok = cs_cholsolsymb(_ccsA, _sparseB, _symbolicCholesky, _csWorkspace, _csIntWorkspace);
+    if (_usePCG){
+      ok = solvePCG(ctx, block, r1, c1, r2, c2);
+    } else if (ctx.sparseDim <= _denseDimension){
+      ok = solveDense(ctx, block, r1, c1, r2, c2);
+    } else if (! block && _mixedPrecision){
+      prepareCholesky(ctx, true);
+      double* blockWorkspace = ctx.csWorkspace + _ccsA->n;
+      ctx.pcgWorkspace.resize(4*_ccsA->n);
+      ctx.refinementSteps = cs_blockcholsolrefine(_ccsA, ctx.sparseB, ctx.symbolicCholesky, ctx.numericCholesky, ctx.csWorkspace, blockWorkspace,
+          ctx.csIntWorkspace, _refinementIterations, _refinementTolerance, &ctx.pcgWorkspace[0], ctx.pool);
+      ok = ctx.refinementSteps >= 0;
+      if (! ok){
+        if (this->verbose())
+          cerr << "mixed precision solve failed, refactorizing in double precision" << endl;
+        prepareCholesky(ctx);
+        ok = cs_blockcholsolnumeric(_ccsA, ctx.sparseB, ctx.symbolicCholesky, ctx.numericCholesky, ctx.csWorkspace, blockWorkspace, ctx.csIntWorkspace,
+            ctx.pool);
+      }
+    } else if (! block){
+      prepareCholesky(ctx);
+      double* blockWorkspace = ctx.csWorkspace + _ccsA->n;
+      ok = cs_blockcholsolnumeric(_ccsA, ctx.sparseB, ctx.symbolicCholesky, ctx.numericCholesky, ctx.csWorkspace, blockWorkspace, ctx.csIntWorkspace,
+          ctx.pool);
+    } else if (r1==c1 && r2==c2 && r2-r1==dim && r1%dim==0){
+      // diagonal block of a vertex, computed from the factor by the sparse inverse
+      prepareCholesky(ctx);
+      double* blockWorkspace = ctx.csWorkspace + _ccsA->n;
+      ctx.sparseInverse.resize(ctx.numericCholesky->p[ctx.numericCholesky->nb]*dim*dim);
+      ok = cs_blockcholsolinvdiagnumeric(_ccsA, block, r1/dim, ctx.sparseB, ctx.symbolicCholesky, ctx.numericCholesky,
+          ctx.csWorkspace, blockWorkspace, ctx.csIntWorkspace, &ctx.sparseInverse[0], ctx.pool);
     } else {
+      prepareCholesky(ctx);
+      double* blockWorkspace = ctx.csWorkspace + _ccsA->n;
       // re-allocate the temporary workspace for cholesky
-      if (_csInvWorkspaceSize < _ccsA->n) {
-        _csInvWorkspaceSize = 2 * _ccsA->n;
-        delete[] _csInvWorkB;
-        _csInvWorkB = new double[_csInvWorkspaceSize];
-        delete[] _csInvWorkTemp;
-        _csInvWorkTemp = new double[_csInvWorkspaceSize];
+      if (ctx.csInvWorkspaceSize < _ccsA->n) {
+        ctx.csInvWorkspaceSize = 2 * _ccsA->n;
+        delete[] ctx.csInvWorkB;
+        ctx.csInvWorkB = new double[ctx.csInvWorkspaceSize];
+        delete[] ctx.csInvWorkTemp;
+        ctx.csInvWorkTemp = new double[ctx.csInvWorkspaceSize];
       }
-      ok = cs_cholsolinvblocksymb(_ccsA, block, r1, c1, r2, c2, _sparseB,
-          _symbolicCholesky, _csWorkspace, _csInvWorkB, _csInvWorkTemp, _csIntWorkspace);
+      ok = cs_blockcholsolinvblocknumeric(_ccsA, block, r1, c1, r2, c2, ctx.sparseB, ctx.symbolicCholesky, ctx.numericCholesky,
+          ctx.csWorkspace, ctx.csInvWorkB, ctx.csInvWorkTemp, blockWorkspace, ctx.csIntWorkspace, ctx.pool);
     }
-    
     if (! ok) {
       cerr << "***** FAILURE *****" << endl;
       ofstream failed("failed.graph");
       this->save(failed);
       abort();
     }
-    cs_spfree(_ccsA);
-    cs_spfree(_csA);
 
-    int dim = PG::TransformationVectorType::TemplateSize;
     int position=0;
-    double* update = _sparseB;
+    double* update = ctx.sparseB;
     static PoseUpdate<PG> poseUpdate;
-    for (int i=0; i<_sparseDim; i += dim) {
-      typename PG::Vertex* v= _ivMap[position];
+    for (int i=0; i<ctx.sparseDim; i += dim) {
+      typename PG::Vertex* v= ctx.ivMap[position];
       poseUpdate(v->transformation, update);
       update += dim;
       position++;
@@ -528,6 +1832,195 @@ namespace AISNavigation{
   }
 
 
+  template <typename PG>
+  void CholOptimizer<PG>::invalidateCovariances(){
+    pthread_mutex_lock(&_sharedMutex);
+    _covarianceValid = false;
+    _covarianceCache.clear();
+    cs_blocknfree(_covarianceCholesky); _covarianceCholesky = 0;
+    pthread_mutex_unlock(&_sharedMutex);
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::prepareCovariances(){
+    invalidateCovariances();
+    _covarianceIndex.clear();
+    if (this->vertices().empty())
+      return false;
+    Graph::VertexSet vset;
+    for (Graph::VertexIDMap::const_iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
+      vset.insert(it->second);
+    }
+    typename PG::Vertex* root=dynamic_cast<typename PG::Vertex*>(this->vertex(_rootNode));
+    if (! root)
+      root=_MY_CAST_<typename PG::Vertex*>(this->vertices().begin()->second);
+    _covarianceRoot=root->id();
+    SolverContext& ctx=defaultContext();
+    buildIndexMapping(ctx, root, vset);
+    if (ctx.ivMap.empty()){
+      _covarianceValid=true;
+      return true;
+    }
+
+    // factorize the system at the current estimate, the factor is kept for the queries
+    releaseCholesky(ctx);
+    computeActiveEdges(ctx, root, vset);
+    buildSparseStructure(ctx);
+    buildLinearSystem(ctx, root, 0.);
+    prepareCholesky(ctx);
+    bool ok = cs_blockchol_numeric(ctx.csA, ctx.symbolicCholesky, ctx.numericCholesky, ctx.csIntWorkspace, ctx.csWorkspace + ctx.csA->n, ctx.pool);
+    if (ok){
+      int nb=ctx.ivMap.size();
+      _covarianceCholesky=ctx.numericCholesky;
+      ctx.numericCholesky=0;
+      if (ctx.symbolicCholesky->pinv)
+        _covariancePinv.assign(ctx.symbolicCholesky->pinv, ctx.symbolicCholesky->pinv + nb);
+      else
+        _covariancePinv.clear();
+      _covarianceParent.assign(ctx.symbolicCholesky->parent, ctx.symbolicCholesky->parent + nb);
+      for (int i=0; i<nb; i++)
+        _covarianceIndex[ctx.ivMap[i]->id()]=i;
+      int dim = PG::TransformationVectorType::TemplateSize;
+      _covarianceSigma.resize(_covarianceCholesky->p[nb]*dim*dim);
+      _covarianceDone.assign(nb, 0);
+      _covarianceWorkspace.resize(std::max(nb*dim*dim, 3*nb*dim));
+      _covarianceIntWorkspace.resize(nb);
+    }
+    releaseCholesky(ctx);
+    clearIndexMapping(ctx);
+    _covarianceValid=ok;
+    return ok;
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::covarianceBlocks(const std::vector< std::pair<int,int> >& pairs, std::vector<typename PG::InformationType>& blocks){
+    int dim = PG::TransformationVectorType::TemplateSize;
+    if (! _covarianceValid && ! prepareCovariances())
+      return false;
+
+    // resolve the ids, a vertex added since the factorization requires a new one
+    std::vector< std::pair<int,int> > index(pairs.size());
+    for (int pass=0; pass<2; pass++){
+      bool missing=false;
+      for (size_t k=0; k<pairs.size() && ! missing; k++){
+        int id[2]={pairs[k].first, pairs[k].second};
+        int idx[2];
+        for (int q=0; q<2; q++){
+          std::map<int,int>::const_iterator it=_covarianceIndex.find(id[q]);
+          if (it!=_covarianceIndex.end()){
+            idx[q]=it->second;
+            continue;
+          }
+          typename PG::Vertex* v=dynamic_cast<typename PG::Vertex*>(this->vertex(id[q]));
+          if (! v)
+            return false;
+          idx[q]=-1;
+          if (v->id()!=_covarianceRoot && ! v->fixed())
+            missing=true;
+        }
+        index[k]=std::make_pair(idx[0], idx[1]);
+      }
+      if (! missing)
+        break;
+      if (pass==1 || ! prepareCovariances())
+        return false;
+    }
+
+    blocks.resize(pairs.size());
+    const int* pinv = _covariancePinv.empty() ? 0 : &_covariancePinv[0];
+    // queries off the pattern of the factor, grouped by the block column they need
+    std::map<int, std::vector<int> > columnQueries;
+    for (size_t k=0; k<pairs.size(); k++){
+      int I=index[k].first, J=index[k].second;
+      typename PG::InformationType& cov=blocks[k];
+      if (I<0 || J<0){
+        cov.fill(0.);
+        continue;
+      }
+      std::pair<int,int> key=std::make_pair(std::min(pairs[k].first, pairs[k].second), std::max(pairs[k].first, pairs[k].second));
+      typename std::map<std::pair<int,int>, typename PG::InformationType>::const_iterator cached=_covarianceCache.find(key);
+      if (cached!=_covarianceCache.end()){
+        cov = (key.first==pairs[k].first) ? cached->second : cached->second.transpose();
+        continue;
+      }
+      int pi = pinv ? pinv[I] : I;
+      int pj = pinv ? pinv[J] : J;
+      int r=std::max(pi,pj), c=std::min(pi,pj);
+      int pos=cs_blockfind(_covarianceCholesky, r, c);
+      if (pos<0){
+        columnQueries[J].push_back(k);
+        continue;
+      }
+      // a block of L lies on the path of its column to the root
+      cs_blocksparseinv(_covarianceCholesky, &_covarianceParent[0], c, &_covarianceSigma[0],
+          &_covarianceWorkspace[0], &_covarianceIntWorkspace[0], &_covarianceDone[0]);
+      const double* S=&_covarianceSigma[pos*dim*dim];
+      for (int a=0; a<dim; a++)
+        for (int b=0; b<dim; b++)
+          cov[a][b] = (pi==r) ? S[b*dim+a] : S[a*dim+b];
+      _covarianceCache[key] = (key.first==pairs[k].first) ? cov : cov.transpose();
+    }
+
+    // one solve per column of the block column J
+    int n=_covarianceCholesky->nb*dim;
+    double* b=&_covarianceWorkspace[0];
+    double* x=b+n;
+    double* column=x+n;
+    std::fill(b, b+n, 0.);
+    for (std::map<int, std::vector<int> >::const_iterator it=columnQueries.begin(); it!=columnQueries.end(); it++){
+      int J=it->first;
+      const std::vector<int>& queries=it->second;
+      for (int c=0; c<dim; c++){
+        b[J*dim+c]=1.;
+        cs_blockipvec(pinv, b, x, _covarianceCholesky->nb, dim);
+        cs_blocklsolve(_covarianceCholesky, x, threadPool());
+        cs_blockltsolve(_covarianceCholesky, x, threadPool());
+        cs_blockpvec(pinv, x, column, _covarianceCholesky->nb, dim);
+        b[J*dim+c]=0.;
+        for (size_t q=0; q<queries.size(); q++){
+          int I=index[queries[q]].first;
+          for (int a=0; a<dim; a++)
+            blocks[queries[q]][a][c]=column[I*dim+a];
+        }
+      }
+      for (size_t q=0; q<queries.size(); q++){
+        const std::pair<int,int>& p=pairs[queries[q]];
+        std::pair<int,int> key=std::make_pair(std::min(p.first, p.second), std::max(p.first, p.second));
+        _covarianceCache[key] = (key.first==p.first) ? blocks[queries[q]] : blocks[queries[q]].transpose();
+      }
+    }
+    return true;
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::marginalCovariances(const std::vector<int>& ids, std::vector<typename PG::InformationType>& covariances){
+    std::vector< std::pair<int,int> > pairs(ids.size());
+    for (size_t k=0; k<ids.size(); k++)
+      pairs[k]=std::make_pair(ids[k], ids[k]);
+    return covarianceBlocks(pairs, covariances);
+  }
+
+  template <typename PG>
+  bool CholOptimizer<PG>::jointCovariances(const std::vector< std::pair<int,int> >& pairs, std::vector<JointCovariance>& covariances){
+    std::vector< std::pair<int,int> > blockPairs;
+    blockPairs.reserve(3*pairs.size());
+    for (size_t k=0; k<pairs.size(); k++){
+      blockPairs.push_back(std::make_pair(pairs[k].first, pairs[k].first));
+      blockPairs.push_back(pairs[k]);
+      blockPairs.push_back(std::make_pair(pairs[k].second, pairs[k].second));
+    }
+    std::vector<typename PG::InformationType> blocks;
+    if (! covarianceBlocks(blockPairs, blocks))
+      return false;
+    covariances.resize(pairs.size());
+    for (size_t k=0; k<pairs.size(); k++){
+      covariances[k].ii=blocks[3*k];
+      covariances[k].ij=blocks[3*k+1];
+      covariances[k].jj=blocks[3*k+2];
+    }
+    return true;
+  }
+
   template <typename PG>
   void CholOptimizer<PG>::transformSubset(typename PG::Vertex* rootVertex, Graph::VertexSet& vset, const typename PG::TransformationType& newRootPose){
     typename PG::TransformationType t=newRootPose*rootVertex->transformation.inverse();
@@ -538,70 +2031,103 @@ namespace AISNavigation{
   }
  
 
+  //! the active edges are given ordered by id, a binary search on them is cheaper than a lookup in the set
   template <typename PG>
   struct ActivePathUniformCostFunction: public PG::PathLengthCostFunction{
-    ActivePathUniformCostFunction(CholOptimizer<PG>* optimizer);
+    ActivePathUniformCostFunction(const std::vector<Graph::Edge*>& activeEdges);
     virtual double operator()(Graph::Edge* edge, Graph::Vertex* from, Graph::Vertex* to);
   protected:
-    CholOptimizer<PG>* _optimizer;
+    const std::vector<Graph::Edge*>& _activeEdges;
   };
   
   template <typename PG>
-  ActivePathUniformCostFunction<PG>::ActivePathUniformCostFunction(CholOptimizer<PG>* optimizer){
-    _optimizer=optimizer;
+  ActivePathUniformCostFunction<PG>::ActivePathUniformCostFunction(const std::vector<Graph::Edge*>& activeEdges):
+    _activeEdges(activeEdges){
   }
     
   template <typename PG>
   double ActivePathUniformCostFunction<PG>::operator()(Graph::Edge* edge, Graph::Vertex* from, Graph::Vertex* to){
-    typename PG::Edge* e = dynamic_cast<typename PG::Edge*>(edge);
-    typename std::set<typename PG::Edge*>::iterator it=_optimizer->_activeEdges.find(e);
-    if (it==_optimizer->_activeEdges.end())
+    if (! std::binary_search(_activeEdges.begin(), _activeEdges.end(), edge, Graph::EdgeIDCompare()))
       return std::numeric_limits<double>::max();
     return 1.;
+    typename PG::Edge* e = dynamic_cast<typename PG::Edge*>(edge);
     typename PG::TransformationType::TranslationType t=e->mean().translation();
     return sqrt(t*t);
   }
 
+  /**
+   * propagates the poses along the dijkstra tree like the PosePropagator, but writes
+   * only the vertices of the subset. The poses of the other vertices of the tree are
+   * kept locally, hence the graph outside the subset is not touched.
+   */
   template <typename PG>
-  void CholOptimizer<PG>::initializeActiveSubsetWithObservations(typename PG::Vertex* root, double maxDistance){
+  struct SubsetPosePropagator: public Dijkstra::TreeAction{
+    typedef typename CholOptimizer<PG>::SolverContext SolverContext;
+    SubsetPosePropagator(const SolverContext& ctx_): ctx(ctx_) {}
+    virtual double perform(Graph::Vertex* v_, Graph::Vertex* vParent_, Graph::Edge* e_){
+      typename PG::Vertex* v =dynamic_cast<typename PG::Vertex*>(v_);
+      typename PG::Vertex* vParent =dynamic_cast<typename PG::Vertex*>(vParent_);
+      typename PG::Edge* e =dynamic_cast<typename PG::Edge*>(e_);
+      assert(v);
+      if (v->fixed())
+        return 1;
+      if (! vParent)
+        return 0;
+      assert(e);
+      bool direction=e->direction(vParent, v);
+      typename PG::TransformationType t=pose(vParent)*e->mean(direction);
+      if (ctx.index(v)!=-1)
+        v->transformation=t;
+      else
+        outside[v]=t;
+      return 1;
+    }
+    const typename PG::TransformationType& pose(const typename PG::Vertex* v) const {
+      typename std::map<const typename PG::Vertex*, typename PG::TransformationType>::const_iterator it=outside.find(v);
+      return it==outside.end() ? v->transformation : it->second;
+    }
+    const SolverContext& ctx;
+    std::map<const typename PG::Vertex*, typename PG::TransformationType> outside;
+  };
+
+  template <typename PG>
+  void CholOptimizer<PG>::initializeActiveSubsetWithObservations(SolverContext& ctx, typename PG::Vertex* root, double maxDistance){
     assert(root);
-    Dijkstra dv(this);
-    std::map<const typename PG::Vertex*, typename PG::TransformationType> tempT;
-    for (typename std::set<typename PG::Edge*>::iterator it=_activeEdges.begin(); it!=_activeEdges.end(); it++){
-      typename PG::Vertex* from=static_cast<typename PG::Vertex*>((*it)->from());
-      typename PG::Vertex* to=static_cast<typename PG::Vertex*>((*it)->to());
-      tempT[from]=from->transformation;
-      tempT[to]=to->transformation;
-    }
-    ActivePathUniformCostFunction<PG> apl(this);
-    dv.shortestPaths(root,&apl,maxDistance);
-    this->propagateAlongDijkstraTree(root, dv.adjacencyMap(), false, true); 
-    for (typename std::set<typename PG::Edge*>::iterator it=_activeEdges.begin(); it!=_activeEdges.end(); it++){
-      typename PG::Vertex* from=static_cast<typename PG::Vertex*>((*it)->from());
-      typename PG::Vertex* to=static_cast<typename PG::Vertex*>((*it)->to());
-      if (from->tempIndex()==-1)
-	from->transformation=tempT[from];
-      if (to->tempIndex()==-1)
-	to->transformation=tempT[to];
+    // the search follows the active edges only, the vertices of the rest of the graph are not needed.
+    // The vertices are sorted before they are put into the set, which then fills in linear time.
+    std::vector<Graph::Edge*> activeEdges(ctx.activeEdges.begin(), ctx.activeEdges.end());
+    std::vector<Graph::Vertex*> vertices;
+    vertices.reserve(2*activeEdges.size()+1);
+    vertices.push_back(root);
+    for (size_t k=0; k<activeEdges.size(); k++){
+      vertices.push_back(activeEdges[k]->from());
+      vertices.push_back(activeEdges[k]->to());
     }
+    std::sort(vertices.begin(), vertices.end(), Graph::VertexIDCompare());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+    Graph::VertexSet reachable(vertices.begin(), vertices.end());
+    Dijkstra dv(this, reachable);
+    ActivePathUniformCostFunction<PG> apl(activeEdges);
+    dv.shortestPaths(root,&apl,maxDistance);
+    Dijkstra::computeTree(root, dv.adjacencyMap());
+    SubsetPosePropagator<PG> propagator(ctx);
+    Dijkstra::visitAdjacencyMap(root, dv.adjacencyMap(), &propagator);
   }
 
 template <typename PG>
-void CholOptimizer<PG>::storeVertices()
+void CholOptimizer<PG>::storeVertices(SolverContext& ctx)
 {
-  for (typename std::vector<typename PG::Vertex*>::iterator it = _ivMap.begin(); it != _ivMap.end(); ++it) {
-    typename PG::Vertex* v = *it;
-    v->storedTransformation = v->transformation;
-  }
+  ctx.storedTransformations.resize(ctx.ivMap.size());
+  for (size_t i = 0; i < ctx.ivMap.size(); ++i)
+    ctx.storedTransformations[i] = ctx.ivMap[i]->transformation;
 }
 
 template <typename PG>
-void CholOptimizer<PG>::restoreVertices()
+void CholOptimizer<PG>::restoreVertices(SolverContext& ctx)
 {
-  for (typename std::vector<typename PG::Vertex*>::iterator it = _ivMap.begin(); it != _ivMap.end(); ++it) {
-    typename PG::Vertex* v = *it;
-    v->transformation = v->storedTransformation;
-  }
+  assert(ctx.storedTransformations.size() == ctx.ivMap.size());
+  for (size_t i = 0; i < ctx.ivMap.size(); ++i)
+    ctx.ivMap[i]->transformation = ctx.storedTransformations[i];
 }
 
 } // end namespace
@@ -18,6 +18,7 @@
 #define _GRAPH_OPTIMIZER_HCHOL_HH_
 
 #include "graph_optimizer_chol.h"
+#include <list>
 
 namespace AISNavigation{
 
@@ -34,8 +35,8 @@ namespace AISNavigation{
       HVertex(int id=-1);
       inline typename PG::Vertex* root() {return _root;}
       inline const typename PG:: Vertex* root() const {return _root;}
-      inline std::set<HVertex*>& children() {return _children;}
-      inline const std::set<HVertex*>& children() const {return _children;}
+      inline std::set<HVertex*, Graph::VertexIDCompare>& children() {return _children;}
+      inline const std::set<HVertex*, Graph::VertexIDCompare>& children() const {return _children;}
       inline typename PG::Vertex* lowerRoot() {return _lowerRoot;}
       inline const typename PG:: Vertex* lowerRoot() const {return _lowerRoot;}
 
@@ -55,11 +56,11 @@ namespace AISNavigation{
       double _distanceToRoot;
       typename PG::Edge* _edgeToRoot;
 
-      std::set<HVertex*> _children;
+      std::set<HVertex*, Graph::VertexIDCompare> _children;
       bool _tainted;
     };
 
-    typedef std::set<HVertex*> HVertexSet;
+    typedef std::set<HVertex*, Graph::VertexIDCompare> HVertexSet;
 
     HCholOptimizer(double maxDistance=3.);
     HCholOptimizer(HCholOptimizer<PG>* lowerLevel, double maxDistance=3.);
@@ -71,6 +72,21 @@ namespace AISNavigation{
     inline bool& propagateDown() {return _propagateDown;}
     inline int& edgeAnnotationIterations() {return _edgeAnnotationIncrementalIterations;}
     inline int& globalIncrementalIterations() {return _globalIncrementalIterations; }
+    /**
+     * adapts the depth of the hierarchy: updateStructure() adds a level on top of a top level with more
+     * vertices than this and removes the levels above one with at most this many. 0 keeps the depth
+     */
+    inline int& maxTopLevelSize() {return _maxTopLevelSize;}
+    /**
+     * adapts maxDistance() to islands of about this many vertices of the level below, by one step per
+     * incremental update of the structure or until the islands fit in a rebuild. 0 keeps the radius
+     */
+    inline int& targetClusterSize() {return _targetClusterSize;}
+    /**
+     * batch optimize() starts with plain Cholesky steps from the guess and runs the V-cycle only if they stop
+     * with TERMINATE_SLOW for this slowConvergenceRatio(). 0 always runs the V-cycle
+     */
+    inline double& directSolveRatio() {return _directSolveRatio;}
 
     virtual typename PG::Vertex* addVertex(const int& k);
     virtual typename PG::Vertex* addVertex(int id, const typename PG::TransformationType& pose, const typename PG::InformationType& information);
@@ -79,7 +95,15 @@ namespace AISNavigation{
     virtual bool removeEdge(Graph::Edge* e);
     virtual bool removeVertex(Graph::Vertex* v);
     virtual void refineEdge(typename PG::Edge* _e, const typename PG::TransformationType& mean, const typename PG::InformationType& information);
+    /**
+     * online: optimizes around the pending changes. Batch: plain Cholesky steps on this level, the first
+     * call starts them from the observations. If they converge slowly (see directSolveRatio()), one V-cycle
+     * through the hierarchy warm-starts at most the given number of iterations on this level instead. The
+     * hierarchy is built the first time it is needed and only updated around the changes afterwards.
+     */
     virtual int optimize(int iterations, bool online=false);
+    //! sparsifies the lowest level, the upper levels are rebuilt around the changes by the next online optimization
+    virtual int sparsify(double maxTranslation, double maxRotation, std::vector<typename CholOptimizer<PG>::MergedVertex>* merged=0);
 
     // for benchmark;
     void annotateHiearchicalEdgeOnDenseGraph(typename PG::TransformationType& mean, typename PG::InformationType& info, typename PG::Edge* e, int iterations, double lambda, bool initWithObservations);
@@ -91,12 +115,36 @@ namespace AISNavigation{
     // general functions
     //bool updateEdgeStructure(Edge* e);
     void annotateHiearchicalEdge(typename PG::Edge* e, int iterations, double lambda, bool initWithObservations);
+    //! optimizes the clusters of the vertices of e in ctx, the context of the lower level if 0, and restores them
+    void computeHierarchicalEdge(typename CholOptimizer<PG>::SolverContext* ctx, typename PG::Edge* e, int iterations, double lambda,
+        bool initWithObservations, typename PG::TransformationType& mean, typename PG::InformationType& covariance);
+    void refineHierarchicalEdge(typename PG::Edge* e, const typename PG::TransformationType& mean, typename PG::InformationType covariance);
+    /**
+     * annotates the edges. With more than one thread in the lower level the cluster pairs are optimized
+     * concurrently, in rounds of edges which neither optimize nor read a vertex optimized by another edge of
+     * the round. Each thread has its own context, the edges are refined afterwards in their order.
+     */
+    void annotateHiearchicalEdges(const std::vector<typename PG::Edge*>& edges, int iterations, double lambda, bool initWithObservations);
+    struct AnnotateTask;
+    friend struct AnnotateTask;
+    //! distributes the jobs into rounds, a job optimizes the children of its vertices and no two jobs of a round touch each other's clusters
+    void scheduleClusters(const std::vector< std::vector<HVertex*> >& jobs, std::vector< std::vector<int> >& rounds) const;
+    //! ensures n contexts for the concurrent calls of optimizeSubset() on the lower level
+    void allocateLowerContexts(int n);
 
 
     // batch optimization
     void annotateHiearchicalEdges(int iterations, double lambda, bool initWithObservations);
     void bottomToTop(int iterations, double lambda, bool initWithObservations);
-    void topToBottom(int iterations, double lambda);
+    void topToBottom(int iterations, double lambda, bool initWithObservations);
+    /**
+     * the two steps of topToBottom() on the thread pool of the lower level, the clusters are processed in the
+     * rounds of scheduleClusters(). The order differs from the serial one, so do the results.
+     */
+    void topToBottomParallel(ThreadPool* pool, int iterations, double lambda, bool initWithObservations);
+    struct RelaxTask;
+    friend struct RelaxTask;
+    //! bottomToTop() followed by topToBottom(), both use the threads of the lower levels
     void vCycle(int iterations, double lambdaUp, double lambdaDown, bool initWithObservations);
 
     // incremental optimization
@@ -112,6 +160,18 @@ namespace AISNavigation{
     void addVertexToUpperLevels(HVertex* v);
     bool optimizePendingIncremental();
     void updateStructure(bool incremental);
+    //! covers the open vertices of the lower level with islands, the new vertices of this level are appended to newVertices
+    void createIslands(std::list<HVertex*>& newVertices);
+    //! the change of maxDistance() that brings the islands of this level closer to targetClusterSize(), 0 if none
+    double maxDistanceStep() const;
+    //! detaches the vertices of the lower level from the islands of this level, the levels below are not changed
+    void releaseLowerLevel();
+    //! copies the settings of the level below to a level added on top of it by updateStructure()
+    void copySettings(HCholOptimizer<PG>* lower);
+    //! makes v a child of hv at the given distance from root, the lower root of hv
+    void claimVertex(HVertex* v, HVertex* hv, HVertex* root, double distance, typename PG::Edge* edgeToRoot);
+    //! claims the open vertices within maxDistance() of the root of the new vertex hv by a breadth first search over the open vertices
+    void growIsland(HVertex* hv, HVertexSet& openSet, HVertexSet& openOldRoots);
     void detachChildren(HVertex* v);
     void cleanupTainted();
     virtual void clear();
@@ -125,6 +185,10 @@ namespace AISNavigation{
     double _lastOptChi;
     bool _gnuplot; // this overrides the standard gnuplot variable :).
     bool _propagateDown;
+    int _maxTopLevelSize;
+    int _targetClusterSize;
+    double _directSolveRatio;
+    bool _batchInitialized; ///< the poses were initialized from the observations by a batch optimize()
     
     double _translationalPropagationError;
     double _rotationalPropagationError;
@@ -134,6 +198,9 @@ namespace AISNavigation{
     int _nVerticesPropagatedDownIncremental;
 
     std::set<int> _rootIDs;
+    HVertexSet _openVertices; ///< vertices of this level outside the islands of the upper one, covered by its createIslands()
+    HVertexSet _taintedVertices; ///< vertices of this level to be removed by cleanupTainted()
+    std::vector<typename CholOptimizer<PG>::SolverContext*> _lowerContexts; ///< one per thread of the lower level, see allocateLowerContexts()
 
   };
 
@@ -45,6 +45,10 @@ namespace AISNavigation{
     _downIncrementalIterations=2;
     _edgeAnnotationIncrementalIterations=5;
     _propagateDown=false;
+    _maxTopLevelSize=0;
+    _targetClusterSize=0;
+    _directSolveRatio=0.1;
+    _batchInitialized=false;
   }
 
   template <typename PG>
@@ -66,6 +70,10 @@ namespace AISNavigation{
     _downIncrementalIterations=3;
     _edgeAnnotationIncrementalIterations=5;
     _propagateDown=false;
+    _maxTopLevelSize=0;
+    _targetClusterSize=0;
+    _directSolveRatio=0.1;
+    _batchInitialized=false;
   }
 
   template <typename PG>
@@ -88,6 +96,10 @@ namespace AISNavigation{
     _downIncrementalIterations=3;
     _edgeAnnotationIncrementalIterations=5;
     _propagateDown=false;
+    _maxTopLevelSize=0;
+    _targetClusterSize=0;
+    _directSolveRatio=0.1;
+    _batchInitialized=false;
   }
   
   template <typename PG>
@@ -96,6 +108,8 @@ namespace AISNavigation{
       delete _upperOptimizer;
       _upperOptimizer=0;
     }
+    for (size_t k=0; k<_lowerContexts.size(); k++)
+      delete _lowerContexts[k];
   }
 
   template <typename PG>
@@ -104,6 +118,41 @@ namespace AISNavigation{
       _upperOptimizer->clear();
     PG::clear();
     _rootIDs.clear();
+    _batchInitialized=false;
+    _openVertices.clear();
+    _taintedVertices.clear();
+  }
+
+  template <typename PG>
+  void HCholOptimizer<PG>::copySettings(HCholOptimizer<PG>* lower){
+    this->verbose()=lower->verbose();
+    this->useManifold()=lower->useManifold();
+    this->chi2Tolerance()=lower->chi2Tolerance();
+    this->updateTolerance()=lower->updateTolerance();
+    this->useLevenbergMarquardt()=lower->useLevenbergMarquardt();
+    this->maxRejections()=lower->maxRejections();
+    this->ordering()=lower->ordering();
+    this->appendFillRatio()=lower->appendFillRatio();
+    this->numThreads()=lower->numThreads();
+    this->denseDimension()=lower->denseDimension();
+    this->usePCG()=lower->usePCG();
+    this->pcgTolerance()=lower->pcgTolerance();
+    this->pcgMaxIterations()=lower->pcgMaxIterations();
+    this->lazyRelinearization()=lower->lazyRelinearization();
+    this->lazyTranslationThreshold()=lower->lazyTranslationThreshold();
+    this->lazyRotationThreshold()=lower->lazyRotationThreshold();
+    this->mixedPrecision()=lower->mixedPrecision();
+    this->refinementIterations()=lower->refinementIterations();
+    this->refinementTolerance()=lower->refinementTolerance();
+    this->regionalUpdates()=lower->regionalUpdates();
+    this->regionDepth()=lower->regionDepth();
+    this->regionLeakThreshold()=lower->regionLeakThreshold();
+    this->regionMaxFraction()=lower->regionMaxFraction();
+    _propagateDown=lower->_propagateDown;
+    _edgeAnnotationIncrementalIterations=lower->_edgeAnnotationIncrementalIterations;
+    _globalIncrementalIterations=lower->_globalIncrementalIterations;
+    _maxTopLevelSize=lower->_maxTopLevelSize;
+    _targetClusterSize=lower->_targetClusterSize;
   }
 
 
@@ -138,6 +187,15 @@ namespace AISNavigation{
   void HCholOptimizer<PG>::annotateHiearchicalEdge(typename PG::Edge* e, int iterations, double lambda, bool initWithObservations){
     if (!_lowerOptimizer)
       return;
+    typename PG::TransformationType mean;
+    typename PG::InformationType covariance;
+    computeHierarchicalEdge(0, e, iterations, lambda, initWithObservations, mean, covariance);
+    refineHierarchicalEdge(e, mean, covariance);
+  }
+
+  template <typename PG>
+  void HCholOptimizer<PG>::computeHierarchicalEdge(typename CholOptimizer<PG>::SolverContext* ctx, typename PG::Edge* e, int iterations,
+      double lambda, bool initWithObservations, typename PG::TransformationType& mean, typename PG::InformationType& covariance){
     HVertex* from = dynamic_cast< HVertex* >( e->from() );
     HVertex* to = dynamic_cast< HVertex* >( e->to() );
     assert (from && to);
@@ -146,8 +204,9 @@ namespace AISNavigation{
 		   from->children().end(),
 		   to->children().begin(),
 		   to->children().end(), 
-		   std::insert_iterator<Graph::VertexSet>(jointSet, jointSet.end()));
-    typename PG::InformationType covariance = PG::InformationType::eye(1.0);
+		   std::insert_iterator<Graph::VertexSet>(jointSet, jointSet.end()),
+		   Graph::VertexIDCompare());
+    covariance = PG::InformationType::eye(1.0);
     int otherId=to->id();
     _lowerOptimizer->backupSubset(jointSet);
 //     cerr << __PRETTY_FUNCTION__ << ": js= "; 
@@ -157,13 +216,20 @@ namespace AISNavigation{
 //     cerr << endl;
 //     cerr << __PRETTY_FUNCTION__ << ": root= " << from->lowerRoot()->id() << endl; 
     //_lowerOptimizer->transformSubset(from->lowerRoot(), jointSet, typename PG::TransformationType());
-    _lowerOptimizer->optimizeSubset(from->lowerRoot(), jointSet, iterations, lambda, initWithObservations, otherId, &covariance);
-    typename PG::TransformationType mean=from->lowerRoot()->transformation.inverse()*to->lowerRoot()->transformation;
+    if (ctx)
+      _lowerOptimizer->optimizeSubset(*ctx, from->lowerRoot(), jointSet, iterations, lambda, initWithObservations, otherId, &covariance);
+    else
+      _lowerOptimizer->optimizeSubset(from->lowerRoot(), jointSet, iterations, lambda, initWithObservations, otherId, &covariance);
+    mean=from->lowerRoot()->transformation.inverse()*to->lowerRoot()->transformation;
     _lowerOptimizer->restoreSubset(jointSet);
-    if (this->verbose()){
+    if (this->verbose() && ! ctx){
       cerr << "u[" << jointSet.size() << "] ";
     }
+  }
 
+  template <typename PG>
+  void HCholOptimizer<PG>::refineHierarchicalEdge(typename PG::Edge* e, const typename PG::TransformationType& mean,
+      typename PG::InformationType covariance){
     if (covariance.det()<0){
       cerr << "![" << covariance.det() << "] " << endl;
       covariance = typename PG::InformationType().eye(1.)*1e9;
@@ -173,6 +239,112 @@ namespace AISNavigation{
     refineEdge(e, mean, covariance);
   }
 
+  template <typename PG>
+  void HCholOptimizer<PG>::scheduleClusters(const std::vector< std::vector<HVertex*> >& jobs, std::vector< std::vector<int> >& rounds) const {
+    // a job optimizes the children of its vertices and reads their neighbors, the first round whose
+    // jobs neither optimize a vertex read by the job nor read a vertex optimized by it takes the job
+    rounds.clear();
+    std::vector< std::set<const Graph::Vertex*> > roundOptimized, roundRead;
+    for (size_t k=0; k<jobs.size(); k++){
+      std::set<const Graph::Vertex*> optimized, read;
+      for (size_t a=0; a<jobs[k].size(); a++)
+        for (typename HVertexSet::const_iterator it=jobs[k][a]->children().begin(); it!=jobs[k][a]->children().end(); it++){
+          optimized.insert(*it);
+          read.insert(*it);
+          for (Graph::EdgeSet::const_iterator et=(*it)->edges().begin(); et!=(*it)->edges().end(); et++){
+            read.insert((*et)->from());
+            read.insert((*et)->to());
+          }
+        }
+      size_t r=0;
+      for (; r<rounds.size(); r++){
+        bool conflict=false;
+        for (std::set<const Graph::Vertex*>::const_iterator it=optimized.begin(); it!=optimized.end() && ! conflict; it++)
+          conflict=roundRead[r].count(*it);
+        for (std::set<const Graph::Vertex*>::const_iterator it=read.begin(); it!=read.end() && ! conflict; it++)
+          conflict=roundOptimized[r].count(*it);
+        if (! conflict)
+          break;
+      }
+      if (r==rounds.size()){
+        rounds.resize(r+1);
+        roundOptimized.resize(r+1);
+        roundRead.resize(r+1);
+      }
+      rounds[r].push_back(k);
+      roundOptimized[r].insert(optimized.begin(), optimized.end());
+      roundRead[r].insert(read.begin(), read.end());
+    }
+  }
+
+  template <typename PG>
+  void HCholOptimizer<PG>::allocateLowerContexts(int n){
+    while ((int)_lowerContexts.size()<n)
+      _lowerContexts.push_back(new typename CholOptimizer<PG>::SolverContext);
+  }
+
+  template <typename PG>
+  struct HCholOptimizer<PG>::AnnotateTask : public ThreadPool::RangeTask
+  {
+    HCholOptimizer<PG>* optimizer;
+    const std::vector<typename PG::Edge*>* edges;
+    const std::vector<int>* round;
+    std::vector<typename PG::TransformationType>* means;
+    std::vector<typename PG::InformationType>* covariances;
+    int iterations;
+    double lambda;
+    bool initWithObservations;
+    virtual void run(int begin, int end, int threadId)
+    {
+      for (int k=begin; k<end; k++){
+        int i=(*round)[k];
+        optimizer->computeHierarchicalEdge(optimizer->_lowerContexts[threadId], (*edges)[i], iterations, lambda, initWithObservations,
+            (*means)[i], (*covariances)[i]);
+      }
+    }
+  };
+
+  template <typename PG>
+  void HCholOptimizer<PG>::annotateHiearchicalEdges(const std::vector<typename PG::Edge*>& edges, int iterations, double lambda,
+      bool initWithObservations){
+    if (!_lowerOptimizer)
+      return;
+    ThreadPool* pool = edges.size()>1 ? _lowerOptimizer->threadPool() : 0;
+    if (! pool){
+      for (size_t k=0; k<edges.size(); k++)
+        annotateHiearchicalEdge(edges[k], iterations, lambda, initWithObservations);
+      return;
+    }
+
+    std::vector< std::vector<HVertex*> > jobs(edges.size());
+    for (size_t k=0; k<edges.size(); k++){
+      jobs[k].push_back(dynamic_cast<HVertex*>(edges[k]->from()));
+      jobs[k].push_back(dynamic_cast<HVertex*>(edges[k]->to()));
+    }
+    std::vector< std::vector<int> > rounds;
+    scheduleClusters(jobs, rounds);
+
+    allocateLowerContexts(pool->numThreads());
+    std::vector<typename PG::TransformationType> means(edges.size());
+    std::vector<typename PG::InformationType> covariances(edges.size(), PG::InformationType::eye(1.));
+    AnnotateTask task;
+    task.optimizer=this;
+    task.edges=&edges;
+    task.means=&means;
+    task.covariances=&covariances;
+    task.iterations=iterations;
+    task.lambda=lambda;
+    task.initWithObservations=initWithObservations;
+    for (size_t r=0; r<rounds.size(); r++){
+      task.round=&rounds[r];
+      pool->parallelFor(rounds[r].size(), 1, task);
+    }
+    if (this->verbose())
+      cerr << "u[" << edges.size() << " edges, " << rounds.size() << " rounds] ";
+    for (size_t k=0; k<edges.size(); k++)
+      refineHierarchicalEdge(edges[k], means[k], covariances[k]);
+  }
+
   template <typename PG>
   void HCholOptimizer<PG>::annotateHiearchicalEdgeOnDenseGraph(typename PG::TransformationType& mean, typename PG::InformationType& info,
       typename PG::Edge* e, int iterations, double lambda, bool initWithObservations){
@@ -266,14 +438,41 @@ namespace AISNavigation{
     assert(!_lowerOptimizer);
     if (! online){
       _online=false;
-      updateStructure(false);
+      typename PG::Vertex* root=dynamic_cast<typename PG::Vertex*>(this->vertex(this->_rootNode));
+      if (! root)
+        root=_MY_CAST_<typename PG::Vertex*>(this->vertices().begin()->second);
+      Graph::VertexSet vset;
+      for (Graph::VertexIDMap::const_iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
+        vset.insert(it->second);
+      }
+      // the first call starts from the observations, plain Cholesky steps come first and a graph on which
+      // they converge slowly is left to the V-cycle
+      bool guess=! _batchInitialized;
+      _batchInitialized=true;
+      if (_directSolveRatio>0.){
+        double slowRatio=this->slowConvergenceRatio();
+        this->slowConvergenceRatio()=_directSolveRatio;
+        this->optimizeSubset(root, vset, iterations, 0., guess);
+        this->slowConvergenceRatio()=slowRatio;
+        if (this->termination()!=CholOptimizer<PG>::TERMINATE_SLOW)
+          return 1;
+      }
+      // the hierarchy is built from scratch the first time, afterwards only around the vertices added or tainted since
+      bool rebuild=_upperOptimizer->vertices().empty();
+      updateStructure(! rebuild);
+      // the update may drop the levels above a graph small enough to be solved as a whole
+      if (! _upperOptimizer){
+        this->optimizeSubset(root, vset, iterations, 0., false);
+        return 1;
+      }
       HCholOptimizer<PG>* uopt=this;
       while(uopt->_upperOptimizer){
 	uopt=uopt->_upperOptimizer;
       }
-      for (int i=0; i<iterations; i++){
-	uopt->vCycle(3,0.,1.,false);
-      }
+      // one V-cycle, the clusters are initialized from the observations only in a new hierarchy
+      uopt->vCycle(3,0.,1.,rebuild);
+      // the coarse solution warm-starts the iterations on this level, which stop as configured by chi2Tolerance()
+      this->optimizeSubset(root, vset, iterations, 0., false);
     } else {
       optimizePendingIncremental();
     }
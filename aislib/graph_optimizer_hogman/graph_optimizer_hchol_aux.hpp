@@ -63,6 +63,9 @@ namespace AISNavigation{
 	v->_parentVertex=0;
 	v->_edgeToRoot=0;
 	v->_distanceToRoot=0;
+	v->_optimizer->_openVertices.insert(v);
+	if (v->_optimizer->_lowerOptimizer)
+	  v->_optimizer->_taintedVertices.insert(v);
     }
     _lowerRoot=0;
     _children.clear();
@@ -71,8 +74,10 @@ namespace AISNavigation{
   template <typename PG>
   void HCholOptimizer<PG>::HVertex::taint(){
     // std::cerr << __PRETTY_FUNCTION__ << this << " id:" << _id << " opt:" << _optimizer <<  " parent=" << _parentVertex << endl;
-    if (_optimizer->_lowerOptimizer)
+    if (_optimizer->_lowerOptimizer){
       _tainted=true;
+      _optimizer->_taintedVertices.insert(this);
+    }
     if (_parentVertex)
       _parentVertex->taint();
   }
@@ -84,7 +89,9 @@ namespace AISNavigation{
     HVertex* vresult=dynamic_cast<HVertex*>(Graph::addVertex(v));
     if (!vresult){
       delete v;
+      return vresult;
     }
+    _openVertices.insert(vresult);
     return vresult;
   }
   
@@ -97,6 +104,7 @@ namespace AISNavigation{
       delete v;
       return vresult;
     }
+    _openVertices.insert(vresult);
     vresult->transformation=pose;
     vresult->covariance=information.inverse();
     return vresult;
@@ -113,8 +121,10 @@ namespace AISNavigation{
       }
       HVertex* hFrom=dynamic_cast<HVertex*>(from);
       hFrom->taint();
-    } else
+    } else {
       e=PG::addEdge(from, to, mean, information);
+      this->markAffected(e);
+    }
     _cachedChi+=this->chi2(e);
     return e;
   };
@@ -123,7 +133,7 @@ namespace AISNavigation{
   template <typename PG>
   void HCholOptimizer<PG>::refineEdge(typename PG::Edge* e, const typename PG::TransformationType& mean, const typename PG::InformationType& information){
     double derr=-this->chi2(e);
-    PG::refineEdge(e,mean,information);
+    CholOptimizer<PG>::refineEdge(e,mean,information);
     derr+=this->chi2(e);
     _cachedChi+=derr;
   }
@@ -144,7 +154,7 @@ namespace AISNavigation{
     typename PG::Edge* eAux = reinterpret_cast<typename PG::Edge*>(e);
     _cachedChi-=this->chi2(eAux);
     _lastOptChi-=this->chi2(eAux);
-    return Graph::removeEdge(e);
+    return CholOptimizer<PG>::removeEdge(e);
   }
   
 
@@ -161,10 +171,20 @@ namespace AISNavigation{
     assert(v);
     if (!_lowerOptimizer)
       v->taint();
-    return Graph::removeVertex(v);
+    _openVertices.erase(v);
+    _taintedVertices.erase(v);
+    return CholOptimizer<PG>::removeVertex(v);
   }
 
 
+  template <typename PG>
+  int HCholOptimizer<PG>::sparsify(double maxTranslation, double maxRotation, std::vector<typename CholOptimizer<PG>::MergedVertex>* merged){
+    if (_lowerOptimizer)
+      return _lowerOptimizer->sparsify(maxTranslation, maxRotation, merged);
+    // the edges are added and the vertices removed by the overrides of this level, which taint the hierarchy
+    return CholOptimizer<PG>::sparsify(maxTranslation, maxRotation, merged);
+  }
+
   template <typename PG>
   void HCholOptimizer<PG>::addVertexToUpperLevels(HVertex* v){
     if (! _upperOptimizer)
@@ -173,6 +193,7 @@ namespace AISNavigation{
     v->_edgeToRoot=0;
     v->_distanceToRoot=0;
     v->_root=v;
+    _openVertices.erase(v);
     HVertex* vup=dynamic_cast<HVertex*>(_upperOptimizer->addVertex(v->id(), v->transformation, v->covariance, 0));
     v->_parentVertex=vup;
     vup->_children.insert(v);
@@ -185,16 +206,13 @@ namespace AISNavigation{
     if (_upperOptimizer)
       _upperOptimizer->cleanupTainted();
     if (_lowerOptimizer){
+      // the vertices tainted or detached from their children since the last cleanup
       HVertexSet removed;
-      for (typename PG::VertexIDMap::iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
-	HVertex* v=dynamic_cast<HVertex*>(it->second);
-	if (v->_tainted || ! v->_lowerRoot){
-	  removed.insert(v);
-	}
-      }
+      removed.swap(_taintedVertices);
       for (typename HVertexSet::iterator it=removed.begin(); it!=removed.end(); it++){
 	HVertex* v=*it;
-	removeVertex(v);
+	if (v->_tainted || ! v->_lowerRoot)
+	  removeVertex(v);
       }
     }
   }
@@ -32,10 +32,11 @@ namespace AISNavigation{
   void HCholOptimizer<PG>::annotateHiearchicalEdges(int iterations, double lambda, bool initWithObservations){
     if (this->verbose())
       cerr <<  "refining edges" << endl; 
+    std::vector<typename PG::Edge*> edges;
     for (typename PG::EdgeSet::iterator it=this->edges().begin(); it!=this->edges().end(); it++){
-      typename PG::Edge* e=dynamic_cast<typename PG::Edge*>(*it);
-      annotateHiearchicalEdge(e,iterations, lambda, initWithObservations);
+      edges.push_back(dynamic_cast<typename PG::Edge*>(*it));
     }
+    annotateHiearchicalEdges(edges, iterations, lambda, initWithObservations);
     if (this->verbose())
       cerr << "done";
   }
@@ -62,7 +63,7 @@ namespace AISNavigation{
       for (Graph::VertexIDMap::const_iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
 	vset.insert(it->second);
       }
-      this->optimizeSubset(rootVertex, vset, iterations*3, lambda, true);
+      this->optimizeSubset(rootVertex, vset, iterations*3, lambda, initWithObservations);
       if (this->verbose()) {
 	cerr << "Done";
 	//ofstream os("topLevel.dat");
@@ -75,37 +76,110 @@ namespace AISNavigation{
   }
 
   template <typename PG>
-  void HCholOptimizer<PG>::topToBottom(int iterations, double lambda){
+  void HCholOptimizer<PG>::topToBottom(int iterations, double lambda, bool initWithObservations){
     if (! _lowerOptimizer)
       return;
 
+    ThreadPool* pool = this->vertices().size()>1 ? _lowerOptimizer->threadPool() : 0;
+    if (pool){
+      topToBottomParallel(pool, iterations, lambda, initWithObservations);
+    } else {
+      int total=0;
+      // first step, project the nodes according to the parent
+      for (Graph::VertexIDMap::iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
+        HVertex* v=dynamic_cast<HVertex*>(it->second);
+        assert(v);
+        _lowerOptimizer->transformSubset(v->lowerRoot(), *(Graph::VertexSet*)(&v->children()), v->transformation);
+        if (initWithObservations)
+          _lowerOptimizer->optimizeSubset (v->lowerRoot(), *(Graph::VertexSet*)(&v->children()), 0, 0., true);
+        total+=v->children().size();
+      }
+      if((int)_lowerOptimizer->vertices().size()!=total){
+        cerr << "fatal error in partitioning: " << _lowerOptimizer->vertices().size()  << " != " << total << endl;  
+      }
+
+      // second step, optimize the nodes, by keeping the neighbors fixed (relaxation)
+      for (Graph::VertexIDMap::iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
+
+        HVertex* v=dynamic_cast<HVertex*>(it->second);
+        assert(v);
+        if (this->verbose()) cerr << "d";
+        _lowerOptimizer->optimizeSubset (v->lowerRoot(), *(Graph::VertexSet*)(&v->children()), iterations, lambda, initWithObservations);
+      }
+    }
+
+    HCholOptimizer<PG>* lowerHOpt=dynamic_cast<HCholOptimizer<PG>*>(_lowerOptimizer);
+    if (lowerHOpt){
+      lowerHOpt->topToBottom(iterations, lambda, initWithObservations);
+    }
+   
+  }
+
+  template <typename PG>
+  struct HCholOptimizer<PG>::RelaxTask : public ThreadPool::RangeTask
+  {
+    HCholOptimizer<PG>* optimizer;
+    const std::vector<HVertex*>* clusters;
+    const std::vector<int>* round;
+    bool project; ///< first step of topToBottom(), the second one otherwise
+    int iterations;
+    double lambda;
+    bool initWithObservations;
+    virtual void run(int begin, int end, int threadId)
+    {
+      HCholOptimizer<PG>* lower=optimizer->_lowerOptimizer;
+      typename CholOptimizer<PG>::SolverContext& ctx=*optimizer->_lowerContexts[threadId];
+      for (int k=begin; k<end; k++){
+        HVertex* v=(*clusters)[(*round)[k]];
+        Graph::VertexSet& children=*(Graph::VertexSet*)(&v->children());
+        if (project){
+          lower->transformSubset(v->lowerRoot(), children, v->transformation);
+          if (initWithObservations)
+            lower->optimizeSubset(ctx, v->lowerRoot(), children, 0, 0., true);
+        } else {
+          lower->optimizeSubset(ctx, v->lowerRoot(), children, iterations, lambda, initWithObservations);
+        }
+      }
+    }
+  };
+
+  template <typename PG>
+  void HCholOptimizer<PG>::topToBottomParallel(ThreadPool* pool, int iterations, double lambda, bool initWithObservations){
+    // the children of a vertex are its cluster, the initialization and the relaxation of a cluster
+    // read the neighboring clusters, which therefore have to be in other rounds
+    std::vector<HVertex*> clusters;
+    std::vector< std::vector<HVertex*> > jobs;
     int total=0;
-    // first step, project the nodes according to the parent
     for (Graph::VertexIDMap::iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
       HVertex* v=dynamic_cast<HVertex*>(it->second);
       assert(v);
-      _lowerOptimizer->transformSubset(v->lowerRoot(), *(Graph::VertexSet*)(&v->children()), v->transformation);
-      _lowerOptimizer->optimizeSubset (v->lowerRoot(), *(Graph::VertexSet*)(&v->children()), 0, 0., true);
+      clusters.push_back(v);
+      jobs.push_back(std::vector<HVertex*>(1, v));
       total+=v->children().size();
     }
     if((int)_lowerOptimizer->vertices().size()!=total){
       cerr << "fatal error in partitioning: " << _lowerOptimizer->vertices().size()  << " != " << total << endl;  
     }
-    
-    // second step, optimize the nodes, by keeping the neighbors fixed (relaxation)
-    for (Graph::VertexIDMap::iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
-
-      HVertex* v=dynamic_cast<HVertex*>(it->second);
-      assert(v);
-      if (this->verbose()) cerr << "d";
-      _lowerOptimizer->optimizeSubset (v->lowerRoot(), *(Graph::VertexSet*)(&v->children()), iterations, lambda, true);
-    }
+    std::vector< std::vector<int> > rounds;
+    scheduleClusters(jobs, rounds);
+    allocateLowerContexts(pool->numThreads());
 
-    HCholOptimizer<PG>* lowerHOpt=dynamic_cast<HCholOptimizer<PG>*>(_lowerOptimizer);
-    if (lowerHOpt){
-      lowerHOpt->topToBottom(iterations, lambda);
+    RelaxTask task;
+    task.optimizer=this;
+    task.clusters=&clusters;
+    task.iterations=iterations;
+    task.lambda=lambda;
+    task.initWithObservations=initWithObservations;
+    // first step, project the nodes according to the parent, second step, relax the clusters
+    for (int step=0; step<2; step++){
+      task.project= step==0;
+      for (size_t r=0; r<rounds.size(); r++){
+        task.round=&rounds[r];
+        pool->parallelFor(rounds[r].size(), 1, task);
+      }
     }
-   
+    if (this->verbose())
+      cerr << "d[" << clusters.size() << " clusters, " << rounds.size() << " rounds] ";
   }
 
   template <typename PG>
@@ -115,7 +189,7 @@ namespace AISNavigation{
       return;
     }
     bottomToTop(iterations, lambdaUp, initWithObservations);
-    topToBottom(iterations, lambdaDown);
+    topToBottom(iterations, lambdaDown, initWithObservations);
   }
 
 }
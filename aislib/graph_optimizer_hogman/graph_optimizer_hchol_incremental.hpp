@@ -31,15 +31,15 @@ namespace AISNavigation{
   bool HCholOptimizer<PG>::optimizePendingIncremental(){
     if (! _lowerOptimizer){
       HVertexSet updatedSet;
-      for (typename PG::VertexIDMap::iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
-	HVertex* v=dynamic_cast<HVertex*>(it->second);
+      for (typename HVertexSet::iterator it=_openVertices.begin(); it!=_openVertices.end(); it++){
+	HVertex* v=*it;
 	if (! v->_root){
 	  updatedSet.insert(v);
 	}
       }
       updateStructure(true);
       optimizeLevels(_propagateDown);
-      std::set<HVertex*> topLevelSet;
+      HVertexSet topLevelSet;
       for (typename HVertexSet::iterator it =updatedSet.begin(); it!=updatedSet.end(); it++){
 	HVertex* v=*it;
 	postprocessIncremental(v);
@@ -91,8 +91,8 @@ namespace AISNavigation{
     _upperOptimizer->propagateDownIncremental(to->parentVertex());
     if (_upperOptimizer){
       HVertex* toParent=to->parentVertex();
-      std::set<HVertex*> upperRegion;
-      for (std::set<Graph::Edge*>::iterator it =toParent->edges().begin(); it!=toParent->edges().end(); it++){
+      HVertexSet upperRegion;
+      for (Graph::EdgeSet::iterator it =toParent->edges().begin(); it!=toParent->edges().end(); it++){
 	HVertex* fpv=dynamic_cast<HVertex*>((*it)->from());
 	HVertex* tpv=dynamic_cast<HVertex*>((*it)->to());
 	upperRegion.insert(fpv);
@@ -121,7 +121,8 @@ namespace AISNavigation{
 	if (this->verbose()) cerr <<"o";
 	bool v=this->verbose();
 	this->verbose()=false;
-	CholOptimizer<PG>::optimize(_globalIncrementalIterations,false);
+	// with regional updates only the region around the new edges is optimized
+	CholOptimizer<PG>::optimize(_globalIncrementalIterations,this->regionalUpdates());
 	_lastOptChi=this->chi2();
 	_cachedChi=_lastOptChi;
 	this->verbose()=v;
@@ -179,12 +180,15 @@ namespace AISNavigation{
     HCholOptimizer<PG>* opt=_upperOptimizer;
     while (opt) {
       const typename PG::EdgeSet& eset=vParent->edges();
+      std::vector<typename PG::Edge*> edges;
       for (typename PG::EdgeSet::iterator it=eset.begin(); it!=eset.end(); it++){
 	typename PG::Edge* e=dynamic_cast<typename PG::Edge*>(*it);	
 	opt->_cachedChi-=chi2(e);
-	opt->annotateHiearchicalEdge(e, _edgeAnnotationIncrementalIterations, 0., false);
-	opt->_cachedChi+=chi2(e);
+	edges.push_back(e);
       }
+      opt->annotateHiearchicalEdges(edges, _edgeAnnotationIncrementalIterations, 0., false);
+      for (size_t k=0; k<edges.size(); k++)
+	opt->_cachedChi+=chi2(edges[k]);
       vParent=vParent->parentVertex();
       opt=opt->_upperOptimizer;
     }
@@ -203,7 +207,7 @@ namespace AISNavigation{
       if (this->verbose()) cerr <<"o";
       bool v=upperOpt->verbose();
       upperOpt->verbose()=false;
-      upperOpt->optimize(_globalIncrementalIterations,false);
+      upperOpt->optimize(_globalIncrementalIterations,upperOpt->regionalUpdates());
       upperOpt->_lastOptChi=upperOpt->chi2();
       upperOpt->_cachedChi=upperOpt->_lastOptChi;
       upperOpt->verbose()=v;
@@ -214,8 +218,6 @@ namespace AISNavigation{
 
   template <typename PG>
   void HCholOptimizer<PG>::updateStructure(bool incremental){
-    typedef  std::set<HVertex*, Graph::VertexIDCompare> HVertexSetID;
-
     if (!_lowerOptimizer && _upperOptimizer){ 
       if (! incremental) {
 	HCholOptimizer<PG> * opt=_upperOptimizer;
@@ -230,6 +232,7 @@ namespace AISNavigation{
 	  v->_edgeToRoot=0;
 	  v->_distanceToRoot=0;
 	  v->_lowerRoot=0;
+	  _openVertices.insert(v);
 	}
       }
       cleanupTainted();
@@ -237,14 +240,100 @@ namespace AISNavigation{
       return;
     }
     
-    typedef std::multimap<double, HVertex*> ProgressiveMap;
+    std::list<HVertex*> newVertices;
+    createIslands(newVertices);
+    // an incremental update changes the radius for the islands to come, a rebuild clusters the level
+    // again until the radius would step back
+    for (double lastStep=0.; ; ){
+      double step=maxDistanceStep();
+      if (step==0. || step==-lastStep)
+	break;
+      _maxDistance+=step;
+      if (this->verbose()) cerr << "maxDistance=" << _maxDistance << endl;
+      if (incremental)
+	break;
+      lastStep=step;
+      releaseLowerLevel();
+      clear();
+      newVertices.clear();
+      createIslands(newVertices);
+    }
+
+#ifndef DNDEBUG
+    if (this->verbose()) cerr << "CONSISTENCY_CHECK " << endl;
+    // check that no vertex is left open and that every vertex claimed by a new island has a parent
+    // which contains it in its children set
+    assert(_lowerOptimizer->_openVertices.empty());
+    for (typename list<HVertex*>::iterator it=newVertices.begin(); it!=newVertices.end(); it++){
+      for (typename HVertexSet::iterator vt=(*it)->_children.begin(); vt!=(*it)->_children.end(); vt++){
+	HVertex * lv= *vt;
+	if (this->verbose()) cerr << "n:" << lv->id() << " p:" << lv->parentVertex()->id() << endl;
+	assert(lv->parentVertex());
+	assert(lv->parentVertex()->children().find(lv)!=lv->parentVertex()->children().end());
+      }
+    }
+#endif
+
+    if (this->verbose())  {
+      cerr << "Edges Creation" << endl;
+      cerr << "newVertices.size=" << newVertices.size()<< endl;
+    }
+
+    // connect the sets
+    std::vector<typename PG::Edge*> newEdges;
+    for (typename list<HVertex*>::iterator it=newVertices.begin(); it!=newVertices.end(); it++){
+      HVertex* hv=dynamic_cast<HVertex*>(*it);
+      for (typename HVertexSet::iterator vt=hv->_children.begin(); vt!=hv->_children.end(); vt++){
+	HVertex* cv=dynamic_cast<HVertex*>(*vt);
+	for (typename PG::EdgeSet::iterator et=cv->edges().begin(); et!=cv->edges().end(); et++){
+	  typename PG::Edge* e=dynamic_cast<typename PG::Edge*>(*et);
+	  HVertex* cv1=dynamic_cast<HVertex*>(e->from());
+	  HVertex* cv2=dynamic_cast<HVertex*>(e->to());
+	  HVertex* pv1=cv1->parentVertex();
+	  HVertex* pv2=cv2->parentVertex();
+	  assert(pv1 && pv2 && (pv1==hv || pv2==hv) );
+	  if (pv1!=pv2 && this->connectingEdges(pv1,pv2).empty() && this->connectingEdges(pv2,pv1).empty()){
+	    typename PG::InformationType info = PG::InformationType::eye(1.);
+            int rotDim = PG::TransformationType::RotationType::Dimension;
+            assert(rotDim + PG::TransformationType::RotationType::Angles == info.rows());
+            for (int i = rotDim; i < info.rows(); ++i)
+              info[i][i]=5;
+	    typename PG::TransformationType mean=pv1->transformation.inverse()*pv2->transformation;
+	    newEdges.push_back(addEdge( pv1, pv2,  mean, info));
+	  }
+	}
+      }
+    }
+    // a batch optimization annotates all the edges in its V-cycle
+    if (incremental && ! newEdges.empty())
+      annotateHiearchicalEdges(newEdges, _edgeAnnotationIncrementalIterations, 0., false);
+    // the hierarchy ends at the first level small enough to be solved as a whole
+    if (_maxTopLevelSize>0 && _upperOptimizer && (int)this->vertices().size()<=_maxTopLevelSize){
+      if (this->verbose()) cerr << "removing the levels above " << this->vertices().size() << " vertices" << endl;
+      _upperOptimizer->releaseLowerLevel();
+      delete _upperOptimizer;
+      _upperOptimizer=0;
+    }
+    if (_maxTopLevelSize>0 && ! _upperOptimizer && (int)this->vertices().size()>_maxTopLevelSize
+	&& this->vertices().size()<_lowerOptimizer->vertices().size()){
+      if (this->verbose()) cerr << "adding a level above " << this->vertices().size() << " vertices" << endl;
+      HCholOptimizer<PG>* opt=new HCholOptimizer<PG>(this, _maxDistance);
+      opt->copySettings(this);
+    }
+    if (_upperOptimizer)
+      _upperOptimizer->updateStructure(incremental);
+  }
+
+  template <typename PG>
+  void HCholOptimizer<PG>::createIslands(std::list<HVertex*>& newVertices){
     // phase1 construct an associationMap
-    HVertexSetID openSet;
-    HVertexSetID openOldRoots;
+    HVertexSet openSet;
+    HVertexSet openOldRoots;
     if (this->verbose()) cerr << "openSet: ";
 
-    for (typename PG::VertexIDMap::iterator it=_lowerOptimizer->vertices().begin(); it!=_lowerOptimizer->vertices().end(); it++){
-      HVertex* v=dynamic_cast<HVertex*>(it->second);
+    // the lower level keeps its open vertices, the update does not visit the covered ones
+    for (typename HVertexSet::iterator it=_lowerOptimizer->_openVertices.begin(); it!=_lowerOptimizer->_openVertices.end(); it++){
+      HVertex* v=*it;
       if (v->_root==0){
 	openSet.insert(v);
 	if (_rootIDs.find(v->id())!=_rootIDs.end()){
@@ -259,15 +348,12 @@ namespace AISNavigation{
 
     if (this->verbose()) cerr << endl;
     if (this->verbose()) cerr << "openSet.size=" << openSet.size()<< endl;
-    std::list<HVertex*> newVertices;
     if (this->verbose()) cerr << "Island Creation" << endl;
-    // create the non-overlapping sets
-    Dijkstra dv(_lowerOptimizer);
-    UniformCostFunction cost;
+    // create the non-overlapping sets, the islands of the old roots are resumed first
     while (! openSet.empty()){
       bool resumedRoot=false;
-      typename HVertexSetID::iterator openIt=openSet.begin();
-      typename HVertexSetID::iterator openOldRootIt=openOldRoots.begin();
+      typename HVertexSet::iterator openIt=openSet.begin();
+      typename HVertexSet::iterator openOldRootIt=openOldRoots.begin();
       if (! openOldRoots.empty()){
 	openIt=openSet.find(*openOldRootIt);
 	resumedRoot=true;
@@ -298,89 +384,84 @@ namespace AISNavigation{
       root->_distanceToRoot=0;
       root->_edgeToRoot=0;
       root->_root=root;
+      _lowerOptimizer->_openVertices.erase(root);
 
       openSet.erase(openIt);
       if (resumedRoot)
 	openOldRoots.erase(openOldRootIt);
 
-      dv.shortestPaths(root,&cost,_maxDistance);
-      ProgressiveMap progressiveMap;
-      for (Graph::VertexSet::const_iterator it=dv.visited().begin(); it!=dv.visited().end(); it++){
-	HVertex* v=dynamic_cast<HVertex*>(*it);
-	double d=dv.adjacencyMap().find(v)->second.distance();
-	progressiveMap.insert(make_pair(d,v));
-      }
-
-      for (typename ProgressiveMap::const_iterator it=progressiveMap.begin(); it!=progressiveMap.end(); it++){
-	HVertex* v=it->second;
-	typename PG::Edge* edgeToRoot=dynamic_cast<typename PG::Edge*>(dv.adjacencyMap().find(v)->second.edge());
-	HVertex* previousV=dynamic_cast<HVertex*>(dv.adjacencyMap().find(v)->second.parent());
-	double d=it->first;
-	if ((v->_root==0/* || v->_distanceToRoot>d*/) && previousV && previousV->_root==root){
-	  typename HVertexSet::iterator ot=openSet.find(v);
+      growIsland(hv, openSet, openOldRoots);
+    }
+  }
 
-	  assert (ot!=openSet.end());
-	  openSet.erase(ot);
-	  typename HVertexSet::iterator oldRootIt=openOldRoots.find(v);
-	  if (oldRootIt!=openOldRoots.end())
-	    openOldRoots.erase(oldRootIt);
+  template <typename PG>
+  void HCholOptimizer<PG>::claimVertex(HVertex* v, HVertex* hv, HVertex* root, double distance, typename PG::Edge* edgeToRoot){
+    v->_parentVertex=hv;
+    v->_distanceToRoot=distance;
+    v->_edgeToRoot=edgeToRoot;
+    v->_root=root;
+    std::set<int>::iterator v_it=_rootIDs.find(v->id());
+    if (v_it!=_rootIDs.end())
+      _rootIDs.erase(v_it);
+    hv->_children.insert(v);
+    _lowerOptimizer->_openVertices.erase(v);
+    if (this->verbose()) cerr << v->id() << " vparent= " << hv->id() << endl;
+  }
 
-	  v->_parentVertex=hv;
-	  v->_distanceToRoot=d;
-	  v->_edgeToRoot=edgeToRoot;
-	  v->_root=root;
-	  std::set<int>::iterator v_it=_rootIDs.find(v->id());
-	  if (v_it!=_rootIDs.end())
-	    _rootIDs.erase(v_it);
-	  hv->_children.insert(v);
-	  if (this->verbose()) cerr << v->id() << " vparent= " << hv->id() << " vprevious=" << previousV->id() << endl;
-	}
+  template <typename PG>
+  void HCholOptimizer<PG>::growIsland(HVertex* hv, HVertexSet& openSet, HVertexSet& openOldRoots){
+    // the cost of an edge is uniform, so the breadth first order is the order of the distances
+    HVertex* root=hv->_lowerRoot;
+    std::vector<HVertex*> frontier(1, root);
+    for (size_t k=0; k<frontier.size(); k++){
+      HVertex* u=frontier[k];
+      double d=u->_distanceToRoot+1.;
+      if (d>=_maxDistance)
+	continue;
+      for (typename PG::EdgeSet::iterator et=u->edges().begin(); et!=u->edges().end(); et++){
+	typename PG::Edge* e=dynamic_cast<typename PG::Edge*>(*et);
+	HVertex* z=dynamic_cast<HVertex*>(e->from()==u ? e->to() : e->from());
+	if (z->_root)
+	  continue;
+	claimVertex(z, hv, root, d, e);
+	openSet.erase(z);
+	openOldRoots.erase(z);
+	frontier.push_back(z);
       }
     }
+  }
 
-#ifndef DNDEBUG
-    if (this->verbose()) cerr << "CONSISTENCY_CHECK " << endl;
-    // check that every children has a parent and that each parent contains the children in its children set;
-    for (typename PG::VertexIDMap::iterator it=_lowerOptimizer->vertices().begin(); it!=_lowerOptimizer->vertices().end(); it++){
-      HVertex * lv= dynamic_cast<HVertex*>(it->second);
-      if (this->verbose()) cerr << "n:" << lv->id() << " p:" << lv->parentVertex()->id() << endl;
-      assert(lv->parentVertex());
-      assert(lv->parentVertex()->children().find(lv)!=lv->parentVertex()->children().end());
-    }
-#endif
-
-    if (this->verbose())  {
-      cerr << "Edges Creation" << endl;
-      cerr << "newVertices.size=" << newVertices.size()<< endl;
-    }
+  template <typename PG>
+  double HCholOptimizer<PG>::maxDistanceStep() const {
+    // the island size is taken from the structure rather than from the solve times, so that the
+    // hierarchy of a graph does not depend on the load of the machine
+    if (_targetClusterSize<=0 || this->vertices().empty())
+      return 0.;
+    double size=(double)_lowerOptimizer->vertices().size()/this->vertices().size();
+    if (size<0.5*_targetClusterSize && this->vertices().size()>1)
+      return 1.;
+    if (size>2.*_targetClusterSize && _maxDistance>2.)
+      return -1.;
+    return 0.;
+  }
 
-    // connect the sets
-    for (typename list<HVertex*>::iterator it=newVertices.begin(); it!=newVertices.end(); it++){
-      HVertex* hv=dynamic_cast<HVertex*>(*it);
+  template <typename PG>
+  void HCholOptimizer<PG>::releaseLowerLevel(){
+    // unlike the destructor of a vertex, the children of the children keep their islands
+    for (typename PG::VertexIDMap::iterator it=this->vertices().begin(); it!=this->vertices().end(); it++){
+      HVertex* hv=dynamic_cast<HVertex*>(it->second);
       for (typename HVertexSet::iterator vt=hv->_children.begin(); vt!=hv->_children.end(); vt++){
-	HVertex* cv=dynamic_cast<HVertex*>(*vt);
-	for (typename PG::EdgeSet::iterator et=cv->edges().begin(); et!=cv->edges().end(); et++){
-	  typename PG::Edge* e=dynamic_cast<typename PG::Edge*>(*et);
-	  HVertex* cv1=dynamic_cast<HVertex*>(e->from());
-	  HVertex* cv2=dynamic_cast<HVertex*>(e->to());
-	  HVertex* pv1=cv1->parentVertex();
-	  HVertex* pv2=cv2->parentVertex();
-	  assert(pv1 && pv2 && (pv1==hv || pv2==hv) );
-	  if (pv1!=pv2 && this->connectingEdges(pv1,pv2).empty() && this->connectingEdges(pv2,pv1).empty()){
-	    typename PG::InformationType info = PG::InformationType::eye(1.);
-            int rotDim = PG::TransformationType::RotationType::Dimension;
-            assert(rotDim + PG::TransformationType::RotationType::Angles == info.rows());
-            for (int i = rotDim; i < info.rows(); ++i)
-              info[i][i]=5;
-	    typename PG::TransformationType mean=pv1->transformation.inverse()*pv2->transformation;
-	    typename PG::Edge* en=addEdge( pv1, pv2,  mean, info);
-	    annotateHiearchicalEdge(en, _edgeAnnotationIncrementalIterations, 0., false);
-	  }
-	}
+	HVertex* v=*vt;
+	v->_root=0;
+	v->_parentVertex=0;
+	v->_edgeToRoot=0;
+	v->_distanceToRoot=0;
+	_lowerOptimizer->_openVertices.insert(v);
       }
+      hv->_children.clear();
+      hv->_lowerRoot=0;
     }
-    if (_upperOptimizer)
-      _upperOptimizer->updateStructure(incremental);
   }
 
+
 }
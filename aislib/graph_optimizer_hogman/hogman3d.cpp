@@ -47,6 +47,35 @@ static const char * banner[]={
   "                              cholesky",
   " -i <int>                   sets the maximum number of iterations (default 10)",
   " -batch                     if toggled, the file is processed in offline mode",
+  " -incchol                   keeps the cholesky factor between the online updates",
+  "                            and updates it incrementally (cholesky only)",
+  " -lag <int>                 fixed-lag smoothing, only the last <int> vertices are",
+  "                            optimized, older ones are marginalized (cholesky only)",
+  " -threads <int>             number of threads of the cholesky optimizer and of",
+  "                            the edge annotation of hogman,",
+  "                            0 uses all cores (default 1)",
+  " -pcg                       solves the linear systems by preconditioned conjugate",
+  "                            gradient instead of cholesky, for very large graphs",
+  " -order <name>              fill reducing ordering of the cholesky factorization:",
+  "                            amd (default), nd (nested dissection), natural",
+  "                            or append (previous order, new vertices last)",
+  " -chi2tol <float>           stops the iterations once the relative change of chi2",
+  "                            falls below this value (default 0, disabled)",
+  " -lm                        levenberg marquardt damping, steps increasing chi2",
+  "                            are rejected",
+  " -mixed                     single precision cholesky factor with iterative",
+  "                            refinement to double precision",
+  " -lazy <float>              lazy relinearization, the jacobians of an edge are",
+  "                            kept until a vertex moved more than this value",
+  " -region <int>              online updates optimize only the vertices within this",
+  "                            many edges of the new edges if the border stays put",
+  " -sparsify <float>          removes the vertices closer than this value to a",
+  "                            neighbor after each online update, later edges of",
+  "                            a removed vertex go to the one it was merged into",
+  " -maxtop <int>              adds and removes levels of the hierarchy so that the",
+  "                            top level has at most this many vertices (hogman only)",
+  " -clustersize <int>         adapts the island radius of each level to islands of",
+  "                            about this many vertices (hogman only)",
   " -update <int>              updates the estimate every x nodes (default 10)",
   " -v                         enables the verbose mode of the optimizer",
   " -guiout                    dumps the output to be piped into graph_viewer",
@@ -65,6 +94,29 @@ void printBanner(){
   }
 }
 
+static int string2ordering(const char* name)
+{
+  const char* names[] = {"natural", "amd", "nd", "append"};
+  for (int i = 0; i < CholOptimizer3D::ORDER_COUNT; ++i)
+    if (! strcmp(name, names[i]))
+      return i;
+  return -1;
+}
+
+typedef map<int, CholOptimizer3D::MergedVertex> MergedMap;
+
+// follows the vertices removed by the sparsification to the vertex they were merged into
+static int resolveMerged(const MergedMap& merged, int id, Transformation3& offset)
+{
+  offset = Transformation3();
+  MergedMap::const_iterator it;
+  while ((it = merged.find(id)) != merged.end()) {
+    offset = it->second.offset * offset;
+    id = it->second.into;
+  }
+  return id;
+}
+
 enum OptimizerType {
   OPT_CHOL, OPT_HCHOL
 };
@@ -94,6 +146,19 @@ int main(int argc, char** argv)
   int iterations = 10;
   bool verbose = false;
   bool incremental = true;
+  bool incrementalFactor = false;
+  int fixedLag = 0;
+  int numThreads = 1;
+  bool usePCG = false;
+  int ordering = -1;
+  double chi2Tolerance = 0.;
+  bool useLevenbergMarquardt = false;
+  bool mixedPrecision = false;
+  double lazyThreshold = -1.;
+  int regionDepth = -1;
+  double sparsifyDistance = -1.;
+  int maxTopLevelSize = 0;
+  int targetClusterSize = 0;
   bool guess = 0;
   int optType = OPT_CHOL;
   int updateGraphEachN = 10;
@@ -117,6 +182,45 @@ int main(int argc, char** argv)
       verbose=true;
     } else if (! strcmp(argv[c],"-batch")){
       incremental = false;
+    } else if (! strcmp(argv[c],"-incchol")){
+      incrementalFactor = true;
+    } else if (! strcmp(argv[c],"-lag")){
+      c++;
+      fixedLag = atoi(argv[c]);
+    } else if (! strcmp(argv[c],"-pcg")){
+      usePCG = true;
+    } else if (! strcmp(argv[c],"-order")){
+      c++;
+      ordering = string2ordering(argv[c]);
+      if (ordering < 0){
+        cerr << "unknown ordering " << argv[c] << endl;
+        return 1;
+      }
+    } else if (! strcmp(argv[c],"-threads")){
+      c++;
+      numThreads = atoi(argv[c]);
+    } else if (! strcmp(argv[c],"-chi2tol")){
+      c++;
+      chi2Tolerance = atof(argv[c]);
+    } else if (! strcmp(argv[c],"-lm")){
+      useLevenbergMarquardt = true;
+    } else if (! strcmp(argv[c],"-mixed")){
+      mixedPrecision = true;
+    } else if (! strcmp(argv[c],"-lazy")){
+      c++;
+      lazyThreshold = atof(argv[c]);
+    } else if (! strcmp(argv[c],"-region")){
+      c++;
+      regionDepth = atoi(argv[c]);
+    } else if (! strcmp(argv[c],"-sparsify")){
+      c++;
+      sparsifyDistance = atof(argv[c]);
+    } else if (! strcmp(argv[c],"-maxtop")){
+      c++;
+      maxTopLevelSize = atoi(argv[c]);
+    } else if (! strcmp(argv[c],"-clustersize")){
+      c++;
+      targetClusterSize = atoi(argv[c]);
     } else if (! strcmp(argv[c],"-update")){
       c++;
       updateGraphEachN = atoi(argv[c]);
@@ -155,14 +259,6 @@ int main(int argc, char** argv)
     verbose = false;
   }
 
-  if (optType==OPT_HCHOL && ! incremental) {
-    cerr << "WARNING: " << endl;
-    cerr << "You selected the batch mode for hogman." << endl;
-    cerr << "This version of HOGMAN is made for on-line operation, not for off-line."  << endl;
-    cerr << "This is an unsupported feature, and it will be slower than standard Cholesky."  << endl;
-    return 0;
-  }
-
 
   ifstream is(filename);
   if (!is) {
@@ -179,12 +275,47 @@ int main(int argc, char** argv)
   cerr << "# outfile=       " << ((outfilename)? outfilename : "not set") << endl;
   cerr << "# infile=        " << ((filename)? filename : "not set") << endl;
   cerr << "# incemental=    " << incremental << endl;
+  cerr << "# incchol=       " << incrementalFactor << endl;
+  cerr << "# threads=       " << numThreads << endl;
+  cerr << "# pcg=           " << usePCG << endl;
   cerr << "# initial guess= " << guess << endl;
 
   // set the optimizer setting
   optimizer->verbose() = verbose;
   optimizer->visualizeToStdout() = visualize;
   optimizer->guessOnEdges() = incremental;
+  CholOptimizer3D* chol3d = dynamic_cast<CholOptimizer3D*>(optimizer);
+  if (chol3d && optType==OPT_CHOL)
+    chol3d->incremental() = incrementalFactor;
+  if (chol3d && optType==OPT_CHOL)
+    chol3d->fixedLag() = fixedLag;
+  // the threads, the solver, the termination and the precision apply to all the levels of the hierarchy
+  HCholOptimizer3D* hchol3d = dynamic_cast<HCholOptimizer3D*>(optimizer);
+  for (int l = 0; ; ++l) {
+    CholOptimizer3D* opt = hchol3d ? hchol3d->level(l) : (l == 0 ? chol3d : 0);
+    if (! opt)
+      break;
+    opt->numThreads() = numThreads;
+    opt->usePCG() = usePCG;
+    if (ordering >= 0)
+      opt->ordering() = ordering;
+    opt->chi2Tolerance() = chi2Tolerance;
+    opt->useLevenbergMarquardt() = useLevenbergMarquardt;
+    opt->mixedPrecision() = mixedPrecision;
+    if (lazyThreshold >= 0.){
+      opt->lazyRelinearization() = true;
+      opt->lazyTranslationThreshold() = lazyThreshold;
+      opt->lazyRotationThreshold() = lazyThreshold;
+    }
+    if (regionDepth >= 0){
+      opt->regionalUpdates() = true;
+      opt->regionDepth() = regionDepth;
+    }
+  }
+  for (int l = 1; hchol3d && hchol3d->level(l); ++l) {
+    hchol3d->level(l)->maxTopLevelSize() = maxTopLevelSize;
+    hchol3d->level(l)->targetClusterSize() = targetClusterSize;
+  }
 
   if (incremental) {
     ofstream stat_fs("stat3d.dat");
@@ -202,12 +333,23 @@ int main(int argc, char** argv)
     bool addNextEdge=true;
     bool freshlyOptimized=false;
     int count=0;
+    MergedMap merged;
     for (LoadedEdgeSet3D::const_iterator it = loadedEdges.begin(); it != loadedEdges.end(); ++it) {
       bool optimize=false;
 
+      // the edges of the removed vertices are redirected, the offsets are below the sparsification distance
+      Transformation3 offset1, offset2;
+      int id1 = resolveMerged(merged, it->id1, offset1);
+      int id2 = resolveMerged(merged, it->id2, offset2);
+      if (id1 == id2) {
+        freshlyOptimized=false;
+        continue;
+      }
+      Transformation3 mean = offset1 * it->mean * offset2.inverse();
+
       if (addNextEdge && !optimizer->vertices().empty()){
         int maxInGraph = optimizer->vertices().rbegin()->first;
-        int idMax = max(it->id1, it->id2);
+        int idMax = max(id1, id2);
         if (maxInGraph < idMax && ! freshlyOptimized){
 	  addNextEdge=false;
 	  optimize=true;
@@ -218,25 +360,25 @@ int main(int argc, char** argv)
 	}
       }
 
-      PoseGraph3D::Vertex* v1 = optimizer->vertex(it->id1);
-      PoseGraph3D::Vertex* v2 = optimizer->vertex(it->id2);
+      PoseGraph3D::Vertex* v1 = optimizer->vertex(id1);
+      PoseGraph3D::Vertex* v2 = optimizer->vertex(id2);
       if (! v1 && addNextEdge) {
-        //cerr << " adding vertex " << it->id1 << endl;
-        v1 = optimizer->addVertex(it->id1, Transformation3(), Matrix6::eye(1.0));
+        //cerr << " adding vertex " << id1 << endl;
+        v1 = optimizer->addVertex(id1, Transformation3(), Matrix6::eye(1.0));
         assert(v1);
 	vertexCount++;
       }
 
       if (! v2 && addNextEdge) {
-        //cerr << " adding vertex " << it->id2 << endl;
-        v2 = optimizer->addVertex(it->id2, Transformation3(), Matrix6::eye(1.0));
+        //cerr << " adding vertex " << id2 << endl;
+        v2 = optimizer->addVertex(id2, Transformation3(), Matrix6::eye(1.0));
         assert(v2);
 	vertexCount++;
       }
 
       if (addNextEdge){
-        //cerr << " adding edge " << it->id1 <<  " " << it->id2 << " " << it->mean << endl;
-        optimizer->addEdge(v1, v2, it->mean, it->informationMatrix);
+        //cerr << " adding edge " << id1 <<  " " << id2 << " " << mean << endl;
+        optimizer->addEdge(v1, v2, mean, it->informationMatrix);
       }
 
       freshlyOptimized=false;
@@ -245,6 +387,12 @@ int main(int argc, char** argv)
         if (vertexCount >= updateGraphEachN){
           gettimeofday(&ts, 0);
           int currentIt=optimizer->optimize(iterations, true);
+          if (chol3d && sparsifyDistance > 0.) {
+            vector<CholOptimizer3D::MergedVertex> removed;
+            chol3d->sparsify(sparsifyDistance, sparsifyDistance, &removed);
+            for (size_t k = 0; k < removed.size(); ++k)
+              merged[removed[k].id] = removed[k];
+          }
 	  
           gettimeofday(&te,0);
           double dts=(te.tv_sec-ts.tv_sec)+1e-6*(te.tv_usec-ts.tv_usec);
@@ -309,6 +457,11 @@ int main(int argc, char** argv)
     cerr << "# final chi=" << optimizer->chi2() << endl;
     cerr << "TOTAL TIME= " << dts << " s." << endl;
   }
+  if (verbose && chol3d && ! usePCG) {
+    const CholOptimizer3D::OrderingStatistics& stats = chol3d->orderingStatistics(chol3d->ordering());
+    cerr << "# ordering: analyses= " << stats.analyses << " time= " << stats.time << " s."
+      << " nnz(L)= " << stats.nnzL << " flops= " << stats.flops << endl;
+  }
 
   if (outfilename) {
     cerr << "Saving Graph to " << outfilename << " ... ";
@@ -0,0 +1,209 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+// 
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "incremental_cholesky.h"
+#include "csparse_helper.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace AISNavigation {
+
+IncrementalBlockCholesky::IncrementalBlockCholesky() :
+  _bs(0), _nonZeros(0)
+{
+}
+
+void IncrementalBlockCholesky::clear()
+{
+  _columns.clear();
+  _y.clear();
+  _x.clear();
+  _touched.clear();
+  _changed.clear();
+  _nonZeros = 0;
+}
+
+void IncrementalBlockCholesky::assign(const cs_block_numeric* N, const double* y)
+{
+  clear();
+  _bs = N->bs;
+  int bb = _bs * _bs;
+  _columns.resize(N->nb);
+  for (int k = 0; k < N->nb; ++k) {
+    Column& c = _columns[k];
+    c.rows.assign(N->i + N->p[k], N->i + N->p[k+1]);
+    c.values.assign(N->x + N->p[k]*bb, N->x + N->p[k+1]*bb);
+    _nonZeros += c.rows.size();
+  }
+  _y.assign(y, y + N->nb * _bs);
+  _x.resize(_y.size(), 0.);
+  _touched.resize(N->nb, true);
+  _changed.resize(N->nb, false);
+}
+
+int IncrementalBlockCholesky::appendBlock()
+{
+  int k = _columns.size();
+  _columns.push_back(Column());
+  Column& c = _columns.back();
+  c.rows.push_back(k);
+  c.values.resize(_bs * _bs, 0.);
+  _y.resize(_y.size() + _bs, 0.);
+  _x.resize(_x.size() + _bs, 0.);
+  _touched.push_back(true);
+  _changed.push_back(false);
+  _nonZeros++;
+  return k;
+}
+
+void IncrementalBlockCholesky::update(const std::vector<int>& rows, std::vector< std::vector<double> >& blocks, std::vector<double>& rhs, int d)
+{
+  const int bs = _bs;
+  const int bb = bs * bs;
+  // the non-zero blocks of W, they fill in along the path of the elimination tree
+  typedef std::map<int, std::vector<double> > BlockMap;
+  BlockMap w;
+  for (size_t k = 0; k < rows.size(); ++k)
+    w[rows[k]].swap(blocks[k]);
+
+  std::vector<double*> wr;
+  while (! w.empty()) {
+    int K = w.begin()->first;
+    std::vector<double> WK;
+    WK.swap(w.begin()->second);
+    w.erase(w.begin());
+    Column& col = _columns[K];
+
+    // the pattern of the column becomes the union of both patterns
+    std::vector<int> newRows;
+    std::vector<double> newValues;
+    newRows.push_back(K);
+    newValues.insert(newValues.end(), col.values.begin(), col.values.begin() + bb);
+    BlockMap::iterator wit = w.begin();
+    size_t q = 1;
+    while (q < col.rows.size() || wit != w.end()) {
+      if (wit == w.end() || (q < col.rows.size() && col.rows[q] < wit->first)) {
+        newRows.push_back(col.rows[q]);
+        newValues.insert(newValues.end(), col.values.begin() + q*bb, col.values.begin() + (q+1)*bb);
+        q++;
+      } else if (q == col.rows.size() || wit->first < col.rows[q]) {
+        newRows.push_back(wit->first);
+        newValues.resize(newValues.size() + bb, 0.);
+        ++wit;
+      } else {
+        newRows.push_back(col.rows[q]);
+        newValues.insert(newValues.end(), col.values.begin() + q*bb, col.values.begin() + (q+1)*bb);
+        q++;
+        ++wit;
+      }
+    }
+    _nonZeros += newRows.size() - col.rows.size();
+    col.rows.swap(newRows);
+    col.values.swap(newValues);
+    wr.resize(col.rows.size());
+    for (size_t b = 1; b < col.rows.size(); ++b) {
+      std::vector<double>& Wb = w[col.rows[b]];
+      if (Wb.empty())
+        Wb.resize(bs * d, 0.);
+      wr[b] = &Wb[0];
+    }
+
+    // givens rotations of [L(:,K) W], one for each scalar column and each column of W
+    double* Lkk = &col.values[0];
+    double* yk = &_y[K*bs];
+    for (int c = 0; c < bs; ++c) {
+      for (int t = 0; t < d; ++t) {
+        double* wt = &WK[t*bs];
+        double beta = wt[c];
+        if (beta == 0.)
+          continue;
+        double alpha = Lkk[c*bs+c];
+        double r = sqrt(alpha*alpha + beta*beta);
+        double cs = alpha / r;
+        double sn = beta / r;
+        Lkk[c*bs+c] = r;
+        wt[c] = 0.;
+        for (int rr = c+1; rr < bs; ++rr) {
+          double l = Lkk[c*bs+rr];
+          Lkk[c*bs+rr] = cs*l + sn*wt[rr];
+          wt[rr] = cs*wt[rr] - sn*l;
+        }
+        for (size_t b = 1; b < col.rows.size(); ++b) {
+          double* Lb = &col.values[b*bb + c*bs];
+          double* wb = wr[b] + t*bs;
+          for (int rr = 0; rr < bs; ++rr) {
+            double l = Lb[rr];
+            Lb[rr] = cs*l + sn*wb[rr];
+            wb[rr] = cs*wb[rr] - sn*l;
+          }
+        }
+        double yc = yk[c];
+        yk[c] = cs*yc + sn*rhs[t];
+        rhs[t] = cs*rhs[t] - sn*yc;
+      }
+    }
+    _touched[K] = true;
+  }
+}
+
+bool IncrementalBlockCholesky::solve(double tolerance)
+{
+  const int bs = _bs;
+  const int bb = bs * bs;
+  const int nb = _columns.size();
+  std::vector<double> v(bs);
+  for (int j = nb - 1; j >= 0; --j) {
+    const Column& col = _columns[j];
+    bool recompute = _touched[j];
+    for (size_t b = 1; b < col.rows.size() && ! recompute; ++b)
+      recompute = _changed[col.rows[b]];
+    _changed[j] = false;
+    if (! recompute)
+      continue;
+
+    // x_j = L(j,j)'\(y_j - sum_r L(r,j)' x_r)
+    for (int c = 0; c < bs; ++c)
+      v[c] = _y[j*bs+c];
+    for (size_t b = 1; b < col.rows.size(); ++b) {
+      const double* L = &col.values[b*bb];
+      const double* xr = &_x[col.rows[b]*bs];
+      for (int c = 0; c < bs; ++c)
+        for (int rr = 0; rr < bs; ++rr)
+          v[c] -= L[c*bs+rr] * xr[rr];
+    }
+    const double* Ljj = &col.values[0];
+    for (int r = bs-1; r >= 0; --r) {
+      double val = v[r];
+      for (int c = r+1; c < bs; ++c)
+        val -= Ljj[r*bs+c] * v[c];
+      if (Ljj[r*bs+r] <= 0.)
+        return false;
+      v[r] = val / Ljj[r*bs+r];
+    }
+    double* xj = &_x[j*bs];
+    double maxDiff = 0.;
+    for (int c = 0; c < bs; ++c) {
+      maxDiff = std::max(maxDiff, fabs(v[c] - xj[c]));
+      xj[c] = v[c];
+    }
+    _changed[j] = maxDiff > tolerance || _touched[j];
+  }
+  std::fill(_touched.begin(), _touched.end(), false);
+  return true;
+}
+
+} // end namespace
@@ -0,0 +1,93 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+// 
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INCREMENTAL_CHOLESKY_H
+#define INCREMENTAL_CHOLESKY_H
+
+#include <vector>
+#include <map>
+#include <cstddef>
+
+namespace AISNavigation {
+
+struct cs_block_numeric;
+
+/**
+ * block cholesky factor L of a system H x = b, which can be updated when
+ * new block columns (vertices) and new terms W W' (edges) are added.
+ * Besides L the factor keeps y = L\b, which is rotated together with L by the
+ * updates, so that the solution only requires the back substitution.
+ * The block columns are in elimination order, new blocks are appended at the end.
+ */
+class IncrementalBlockCholesky
+{
+  public:
+    IncrementalBlockCholesky();
+
+    void clear();
+
+    /**
+     * initialize from the numeric factor N and y=L\b.
+     */
+    void assign(const cs_block_numeric* N, const double* y);
+
+    //! appends an empty block column with zero diagonal, returns its position
+    int appendBlock();
+
+    /**
+     * L L' + W W' and y accordingly, W consists of d columns whose non-zero blocks are
+     * the block rows rows[k], stored bs x d in column major order in blocks[k].
+     * rhs contains the d right hand side entries of the new terms, i.e., b += W rhs.
+     * The blocks and rhs are used as workspace.
+     */
+    void update(const std::vector<int>& rows, std::vector< std::vector<double> >& blocks, std::vector<double>& rhs, int d);
+
+    /**
+     * solves L' x = y. Only the blocks which were touched by an update since the
+     * last call or which depend on a block whose solution changed by more than tolerance
+     * are recomputed, tolerance = 0 gives the exact solution.
+     * @return false if the factor is singular
+     */
+    bool solve(double tolerance);
+
+    //! solution of the last call to solve()
+    const double* x(int k) const {return &_x[k*_bs];}
+    //! true, if the solution of block k changed in the last call to solve()
+    bool changed(int k) const {return _changed[k];}
+
+    int size() const {return (int)_columns.size();}
+    int blockSize() const {return _bs;}
+    //! number of blocks in L
+    size_t nonZeros() const {return _nonZeros;}
+
+  protected:
+    struct Column {
+      std::vector<int> rows;      ///< block rows, the first one is the diagonal
+      std::vector<double> values; ///< bs*bs values per block in column major order
+    };
+
+    int _bs;
+    std::vector<Column> _columns;
+    std::vector<double> _y;
+    std::vector<double> _x;
+    std::vector<bool> _touched;
+    std::vector<bool> _changed;
+    size_t _nonZeros;
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,114 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+// 
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "symbolic_cache.h"
+
+#include <cassert>
+
+extern "C" {
+#include <EXTERNAL/csparse/cs.h>
+};
+
+namespace AISNavigation {
+
+SymbolicCholeskyCache::SymbolicCholeskyCache(int capacity) :
+  _capacity(capacity < 1 ? 1 : capacity), _hits(0), _misses(0)
+{
+}
+
+SymbolicCholeskyCache::~SymbolicCholeskyCache()
+{
+  for (EntryList::iterator it = _entries.begin(); it != _entries.end(); ++it)
+    cs_sfree(it->symbolic);
+}
+
+css* SymbolicCholeskyCache::find(const std::vector<int>& signature, size_t hash)
+{
+  for (EntryList::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+    if (it->hash == hash && it->signature == signature) {
+      _entries.splice(_entries.begin(), _entries, it);
+      _hits++;
+      _entries.front().references++;
+      return _entries.front().symbolic;
+    }
+  }
+  _misses++;
+  return 0;
+}
+
+void SymbolicCholeskyCache::insert(const std::vector<int>& signature, size_t hash, css* S)
+{
+  if (! S)
+    return;
+  shrink(_capacity - 1);
+  _entries.push_front(Entry());
+  Entry& e = _entries.front();
+  e.hash = hash;
+  e.signature = signature;
+  e.symbolic = S;
+  e.references = 1;
+}
+
+void SymbolicCholeskyCache::release(const css* S)
+{
+  if (! S)
+    return;
+  for (EntryList::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+    if (it->symbolic == S) {
+      assert(it->references > 0);
+      it->references--;
+      break;
+    }
+  }
+  shrink(_capacity);
+}
+
+void SymbolicCholeskyCache::clear()
+{
+  shrink(0);
+}
+
+void SymbolicCholeskyCache::setCapacity(int capacity)
+{
+  _capacity = capacity < 1 ? 1 : capacity;
+  shrink(_capacity);
+}
+
+void SymbolicCholeskyCache::shrink(int maxSize)
+{
+  // entries in use stay in the cache even if it exceeds the capacity
+  EntryList::iterator it = _entries.end();
+  while ((int)_entries.size() > maxSize && it != _entries.begin()) {
+    --it;
+    if (it->references > 0)
+      continue;
+    cs_sfree(it->symbolic);
+    it = _entries.erase(it);
+  }
+}
+
+size_t SymbolicCholeskyCache::hashSignature(const std::vector<int>& signature)
+{
+  // FNV-1a over the ints
+  size_t h = 2166136261u;
+  for (size_t i = 0; i < signature.size(); ++i) {
+    h ^= (size_t) signature[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+} // end namespace
@@ -0,0 +1,93 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+// 
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SYMBOLIC_CACHE_H
+#define SYMBOLIC_CACHE_H
+
+#include <list>
+#include <vector>
+#include <cstddef>
+
+struct cs_symbolic;
+typedef struct cs_symbolic css;
+
+namespace AISNavigation {
+
+/**
+ * least recently used cache of symbolic cholesky factorizations.
+ * A factorization is identified by a signature of the block structure of the
+ * system matrix, e.g., the list of block rows of each block column. Two subsets
+ * with the same signature share the ordering and the elimination tree.
+ * The cache owns the stored factorizations. Each find() or insert() acquires a
+ * reference to the factorization which has to be given back by release(), an
+ * entry is only evicted if it is not referenced anymore. The cache does no
+ * locking on its own.
+ */
+class SymbolicCholeskyCache
+{
+  public:
+    explicit SymbolicCholeskyCache(int capacity = 32);
+    ~SymbolicCholeskyCache();
+
+    /**
+     * look up the factorization for the given signature, the entry becomes the most recently used one.
+     * On success a reference to the factorization is acquired.
+     * @return the factorization or 0 if it is not in the cache
+     */
+    css* find(const std::vector<int>& signature, size_t hash);
+    /**
+     * store S for the signature, the cache takes the ownership of S and the caller holds a reference to it.
+     * If the cache is full, the least recently used entry which is not referenced is freed.
+     */
+    void insert(const std::vector<int>& signature, size_t hash, css* S);
+    //! give back a reference acquired by find() or insert()
+    void release(const css* S);
+    //! frees all entries which are not referenced
+    void clear();
+
+    int capacity() const {return _capacity;}
+    void setCapacity(int capacity);
+    int size() const {return (int)_entries.size();}
+    int hits() const {return _hits;}
+    int misses() const {return _misses;}
+
+    //! hash of a signature
+    static size_t hashSignature(const std::vector<int>& signature);
+
+  protected:
+    struct Entry {
+      size_t hash;
+      std::vector<int> signature;
+      css* symbolic;
+      int references;
+    };
+    typedef std::list<Entry> EntryList;
+
+    void shrink(int maxSize);
+
+    EntryList _entries; ///< front is the most recently used one
+    int _capacity;
+    int _hits;
+    int _misses;
+
+  private:
+    SymbolicCholeskyCache(const SymbolicCholeskyCache&);
+    SymbolicCholeskyCache& operator=(const SymbolicCholeskyCache&);
+};
+
+} // end namespace
+
+#endif
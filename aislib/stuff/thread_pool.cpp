@@ -0,0 +1,175 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+// 
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "thread_pool.h"
+
+#include <unistd.h>
+#include <algorithm>
+
+namespace {
+  struct RangeChunk : public ThreadPool::Task
+  {
+    ThreadPool::RangeTask* task;
+    int begin, end;
+    virtual void run(ThreadPool&, int threadId)
+    {
+      task->run(begin, end, threadId);
+    }
+  };
+}
+
+ThreadPool::ThreadPool(int numThreads) :
+  _numThreads(numThreads > 0 ? numThreads : hardwareThreads()), _pending(0), _queued(0), _shutdown(false)
+{
+  pthread_mutex_init(&_mutex, 0);
+  pthread_cond_init(&_cond, 0);
+  _workers.resize(_numThreads);
+  for (int i = 0; i < _numThreads; ++i) {
+    _workers[i].pool = this;
+    _workers[i].id = i;
+  }
+  for (int i = 1; i < _numThreads; ++i) {
+    if (pthread_create(&_workers[i].thread, 0, workerMain, &_workers[i]) != 0) {
+      // run with the threads we got so far
+      _numThreads = i;
+      _workers.resize(i);
+      break;
+    }
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  pthread_mutex_lock(&_mutex);
+  _shutdown = true;
+  pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_mutex);
+  for (int i = 1; i < _numThreads; ++i)
+    pthread_join(_workers[i].thread, 0);
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_mutex);
+}
+
+void ThreadPool::spawn(Task* task, int threadId)
+{
+  pthread_mutex_lock(&_mutex);
+  _workers[threadId].queue.push_back(task);
+  _pending++;
+  _queued++;
+  pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_mutex);
+}
+
+ThreadPool::Task* ThreadPool::pop(int threadId)
+{
+  Task* task = 0;
+  pthread_mutex_lock(&_mutex);
+  if (_queued > 0) {
+    std::deque<Task*>& own = _workers[threadId].queue;
+    if (! own.empty()) {
+      task = own.back();
+      own.pop_back();
+    } else {
+      for (int i = 1; i < _numThreads && ! task; ++i) {
+        std::deque<Task*>& other = _workers[(threadId + i) % _numThreads].queue;
+        if (! other.empty()) {
+          task = other.front();
+          other.pop_front();
+        }
+      }
+    }
+    if (task)
+      _queued--;
+  }
+  pthread_mutex_unlock(&_mutex);
+  return task;
+}
+
+void ThreadPool::finish()
+{
+  pthread_mutex_lock(&_mutex);
+  _pending--;
+  if (_pending == 0)
+    pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_mutex);
+}
+
+void ThreadPool::wait()
+{
+  while (true) {
+    Task* task = pop(0);
+    if (task) {
+      task->run(*this, 0);
+      finish();
+      continue;
+    }
+    pthread_mutex_lock(&_mutex);
+    while (_pending > 0 && _queued == 0)
+      pthread_cond_wait(&_cond, &_mutex);
+    bool done = _pending == 0;
+    pthread_mutex_unlock(&_mutex);
+    if (done)
+      return;
+  }
+}
+
+void* ThreadPool::workerMain(void* arg)
+{
+  Worker* worker = static_cast<Worker*>(arg);
+  ThreadPool* pool = worker->pool;
+  while (true) {
+    Task* task = pool->pop(worker->id);
+    if (task) {
+      task->run(*pool, worker->id);
+      pool->finish();
+      continue;
+    }
+    pthread_mutex_lock(&pool->_mutex);
+    while (! pool->_shutdown && pool->_queued == 0)
+      pthread_cond_wait(&pool->_cond, &pool->_mutex);
+    bool shutdown = pool->_shutdown;
+    pthread_mutex_unlock(&pool->_mutex);
+    if (shutdown)
+      break;
+  }
+  return 0;
+}
+
+void ThreadPool::parallelFor(int n, int grainSize, RangeTask& task)
+{
+  if (grainSize < 1)
+    grainSize = 1;
+  if (_numThreads == 1 || n <= grainSize) {
+    if (n > 0)
+      task.run(0, n, 0);
+    return;
+  }
+  std::vector<RangeChunk> chunks((n + grainSize - 1) / grainSize);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    chunks[i].task = &task;
+    chunks[i].begin = i * grainSize;
+    chunks[i].end = std::min(n, (int)(i+1) * grainSize);
+  }
+  for (size_t i = 0; i < chunks.size(); ++i)
+    spawn(&chunks[i], 0);
+  wait();
+}
+
+int ThreadPool::hardwareThreads()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int) n : 1;
+}
@@ -0,0 +1,106 @@
+// HOG-Man - Hierarchical Optimization for Pose Graphs on Manifolds
+// Copyright (C) 2010 G. Grisetti, R. Kümmerle, C. Stachniss
+// 
+// HOG-Man is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// HOG-Man is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+/**
+ * \brief a pool of worker threads with work stealing
+ *
+ * Each thread owns a queue of tasks. A thread executes the tasks of its own queue
+ * in LIFO order and steals the oldest tasks from the other queues if its queue is empty.
+ * The thread calling wait() participates as thread 0, hence a pool with one thread
+ * does not create any additional thread and executes everything inside wait().
+ */
+class ThreadPool
+{
+  public:
+    /**
+     * a unit of work, it may spawn further tasks via pool.spawn(..., threadId)
+     */
+    class Task
+    {
+      public:
+        virtual ~Task() {}
+        virtual void run(ThreadPool& pool, int threadId) = 0;
+    };
+
+    /**
+     * work on the range [begin, end) of a parallelFor()
+     */
+    class RangeTask
+    {
+      public:
+        virtual ~RangeTask() {}
+        virtual void run(int begin, int end, int threadId) = 0;
+    };
+
+    /**
+     * @param numThreads number of threads including the calling one, <=0 selects the number of cores
+     */
+    explicit ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+
+    int numThreads() const { return _numThreads;}
+
+    /**
+     * adds a task to the queue of threadId, the pool does not take the ownership.
+     */
+    void spawn(Task* task, int threadId = 0);
+
+    /**
+     * executes tasks until all spawned tasks (and the ones spawned by them) are done.
+     */
+    void wait();
+
+    /**
+     * calls task.run() for consecutive chunks of at most grainSize elements of [0, n) and waits.
+     */
+    void parallelFor(int n, int grainSize, RangeTask& task);
+
+    //! number of cores of the machine
+    static int hardwareThreads();
+
+  protected:
+    Task* pop(int threadId);
+    void finish();
+    static void* workerMain(void* arg);
+
+    struct Worker {
+      ThreadPool* pool;
+      int id;
+      pthread_t thread;
+      std::deque<Task*> queue;
+    };
+
+    int _numThreads;
+    std::vector<Worker> _workers;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    int _pending;   ///< spawned tasks which are not finished
+    int _queued;    ///< tasks in the queues
+    bool _shutdown;
+
+  private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+#endif
@@ -0,0 +1,44 @@
+
+### You should not need to change anything below.
+LINUX=1
+
+# Compilers
+CC=gcc
+CXX=g++
+
+# prefix for the library name
+LIB_PREFIX=hogman_
+
+# Paths
+ROOTDIR=/root/repo
+LIBDIR=/root/repo/lib
+BINDIR=/root/repo/bin
+
+# Build tools
+PRETTY=/root/repo/build_tools/pretty_compiler
+MESSAGE=/root/repo/build_tools/message
+TESTLIB=/root/repo/build_tools/testlib
+
+# Generic makefiles
+MAKEFILE_GENERIC=/root/repo/build_tools/Makefile.generic-shared-object
+MAKEFILE_APP=/root/repo/build_tools/Makefile.app
+MAKEFILE_SUBDIRS=/root/repo/build_tools/Makefile.subdirs
+
+# Flags
+CPPFLAGS+=-DLINUX -I/root/repo  
+CXXFLAGS+=-fPIC
+LDFLAGS+= -Wl,-rpath,/root/repo/lib
+CARMENSUPPORT=
+
+# QT support
+MOC=/usr/bin/moc-qt4
+UIC=/usr/bin/uic-qt4
+QT_LIB=-L/usr/share/qt4/lib/ -lQtCore -lQtGui -lQtDesigner -lQtOpenGL -lQtXml
+QT_INCLUDE=-I/usr/include/qt4 -I/usr/include/qt4/QtCore -I/usr/include/qt4/QtGui -I/usr/include/qt4/QtXml -I/usr/include/qt4/QtOpenGL
+
+
+
+
+include /root/repo/manual.mk
+
+CXXFLAGS += -std=gnu++98 -fpermissive -w